@@ -0,0 +1,414 @@
+/**
+ * Buddy Allocator Microbenchmarks
+ *
+ * Times the allocator on a handful of fixed workloads: alloc/free ping-pong
+ * per block order, random-size churn, filling an arena until it runs out and
+ * draining it, the deepest split and merge, and multithreaded runs on shared
+ * plain and concurrent arenas. Every benchmark runs twice: once untimed per
+ * operation, for ns/op and ops/s, and once timing each operation, for the
+ * latency percentiles.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buddy.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+/* arena every benchmark runs on: 64MB of 4K pages */
+#define BENCH_MIN_ORDER 12
+#define BENCH_MAX_ORDER 26
+#define BENCH_ARENA_SIZE ((size_t)1 << BENCH_MAX_ORDER)
+
+/* operations per benchmark, per thread, unless changed with -n */
+#define BENCH_DEFAULT_OPS 1000000
+
+/* most threads the multithreaded benchmarks use, unless changed with -t */
+#define BENCH_DEFAULT_THREADS 8
+
+/* live blocks the churn benchmark juggles, split among its threads, and orders its sizes span above BENCH_MIN_ORDER.
+ * About half the slots are live at a time, under 48MB, so the arena does not run out and count failed allocations as operations */
+#define BENCH_CHURN_SLOTS 1024
+#define BENCH_CHURN_ORDERS 6
+
+/* runs one allocator operation, timing it if the context collects latencies */
+#define BENCH_OP(ctx, stmt) do {					\
+	if ((ctx)->lat && (ctx)->done < (ctx)->ops) {			\
+		uint64_t t0_ = now_ns();				\
+		stmt;							\
+		(ctx)->lat[(ctx)->done] = now_ns() - t0_;		\
+	}								\
+	else {								\
+		stmt;							\
+	}								\
+	(ctx)->done++;							\
+} while (0)
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+/* a benchmark: runs ctx->ops operations between bench_start and bench_stop */
+typedef struct bench_ctx bench_ctx_t;
+typedef void (*bench_fn)(bench_ctx_t *ctx);
+
+/**
+ * State of one benchmark thread
+ */
+struct bench_ctx {
+	bench_fn fn;			///< The benchmark
+	buddy_arena_t *arena;		///< Arena to allocate from, shared by all threads of a run
+	int order;			///< Block order, for benchmarks that take one
+	int threads;			///< Number of threads sharing the arena
+	long ops;			///< Operations to run
+	long done;			///< Operations run so far
+	uint32_t *lat;			///< If not NULL, receives the latency of each of the first ops operations in ns
+	uint64_t seed;			///< State of the thread's random number generator
+	pthread_barrier_t *start;	///< If not NULL, every thread of the run waits here before starting the clock
+	uint64_t elapsed_ns;		///< Time spent in the timed loop
+};
+
+/**
+ * Result of a benchmark run
+ */
+typedef struct {
+	double ns_per_op;	///< Average time a thread spends per operation
+	double ops_per_sec;	///< Operations per second over all threads
+	uint32_t p50, p99, p999;	///< Latency percentiles in ns
+} bench_result_t;
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+//monotonic time in nanoseconds
+static inline uint64_t now_ns(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//next number of a xorshift64 generator
+static inline uint64_t bench_rand(bench_ctx_t *ctx){
+	ctx->seed ^= ctx->seed << 13;
+	ctx->seed ^= ctx->seed >> 7;
+	ctx->seed ^= ctx->seed << 17;
+	return ctx->seed;
+}
+
+//starts the clock of a benchmark thread, once every thread of the run is ready
+static void bench_start(bench_ctx_t *ctx){
+	if (ctx->start)
+		pthread_barrier_wait(ctx->start);
+	ctx->done = 0;
+	ctx->elapsed_ns = now_ns();
+}
+
+//stops the clock of a benchmark thread
+static void bench_stop(bench_ctx_t *ctx){
+	ctx->elapsed_ns = now_ns() - ctx->elapsed_ns;
+}
+
+//allocates and frees a block of ctx->order over and over. Its buddy stays allocated, so nothing splits or merges
+static void bench_pingpong(bench_ctx_t *ctx){
+	size_t size = (size_t)1 << ctx->order;
+	void *buddy = buddy_arena_alloc(ctx->arena, size);
+	void *addr = NULL;
+
+	bench_start(ctx);
+	while (ctx->done < ctx->ops) {
+		BENCH_OP(ctx, addr = buddy_arena_alloc(ctx->arena, size));
+		BENCH_OP(ctx, buddy_arena_free(ctx->arena, addr));
+	}
+	bench_stop(ctx);
+
+	buddy_arena_free(ctx->arena, buddy);
+}
+
+//allocates and frees the smallest block in an otherwise free arena, so every operation splits or merges all the way
+static void bench_deep(bench_ctx_t *ctx){
+	size_t size = (size_t)1 << BENCH_MIN_ORDER;
+	void *addr = NULL;
+
+	bench_start(ctx);
+	while (ctx->done < ctx->ops) {
+		BENCH_OP(ctx, addr = buddy_arena_alloc(ctx->arena, size));
+		BENCH_OP(ctx, buddy_arena_free(ctx->arena, addr));
+	}
+	bench_stop(ctx);
+}
+
+//frees or allocates a random slot of a pool of live blocks, of random sizes over several orders
+static void bench_churn(bench_ctx_t *ctx){
+	void *slots[BENCH_CHURN_SLOTS] = { NULL };
+	int num_slots = BENCH_CHURN_SLOTS / ctx->threads;	//the threads share the arena, so they share the live blocks too
+	int i;
+
+	bench_start(ctx);
+	while (ctx->done < ctx->ops) {
+		uint64_t r = bench_rand(ctx);
+		void **slot = &slots[r % num_slots];
+		int order = BENCH_MIN_ORDER + (r >> 16) % (BENCH_CHURN_ORDERS + 1);
+		size_t size = ((size_t)1 << order) - (r >> 32) % ((size_t)1 << (order - 1));	//anywhere in the upper half of the order
+
+		if (*slot)
+			BENCH_OP(ctx, { buddy_arena_free(ctx->arena, *slot); *slot = NULL; });
+		else
+			BENCH_OP(ctx, *slot = buddy_arena_alloc(ctx->arena, size));
+	}
+	bench_stop(ctx);
+
+	for (i = 0; i < num_slots; i++)
+		buddy_arena_free(ctx->arena, slots[i]);
+}
+
+//allocates single pages until the arena runs out, then frees them all, over and over
+static void bench_fill(bench_ctx_t *ctx){
+	long max_blocks = BENCH_ARENA_SIZE >> BENCH_MIN_ORDER;
+	void **addrs = malloc(max_blocks * sizeof(*addrs));
+	long n, i;
+
+	if (!addrs)
+		return;
+
+	bench_start(ctx);
+	while (ctx->done < ctx->ops) {
+		void *addr;
+
+		for (n = 0; ; n++) {
+			BENCH_OP(ctx, addr = buddy_arena_alloc(ctx->arena, (size_t)1 << BENCH_MIN_ORDER));
+			if (!addr)
+				break;
+			addrs[n] = addr;
+		}
+		for (i = 0; i < n; i++)
+			BENCH_OP(ctx, buddy_arena_free(ctx->arena, addrs[i]));
+	}
+	bench_stop(ctx);
+
+	free(addrs);
+}
+
+//runs a benchmark thread
+static void *bench_thread(void *arg){
+	bench_ctx_t *ctx = arg;
+
+	ctx->fn(ctx);
+	return NULL;
+}
+
+//orders latencies ascending
+static int lat_cmp(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+//runs a benchmark on a fresh arena, with the given number of threads sharing it
+/*
+ * @param fn the benchmark
+ * @param flags BUDDY_ARENA_* flags of the arena
+ * @param order block order passed to the benchmark
+ * @param threads number of threads
+ * @param ops operations per thread
+ * @param timed collect per-operation latencies rather than throughput
+ * @param result receives ns/op and ops/s, or the percentiles if timed
+ * @return false if out of memory
+ */
+static bool bench_run(bench_fn fn, unsigned flags, int order, int threads, long ops, bool timed, bench_result_t *result){
+	bench_ctx_t *ctxs = calloc(threads, sizeof(*ctxs));
+	uint32_t *lat = timed ? malloc((size_t)threads * ops * sizeof(*lat)) : NULL;
+	buddy_arena_t *arena = buddy_arena_create_mmap(BENCH_ARENA_SIZE, BENCH_MIN_ORDER, BENCH_MAX_ORDER, flags);
+	pthread_t *tids = malloc(threads * sizeof(*tids));
+	pthread_barrier_t start;
+	uint64_t elapsed = 0;
+	long total = 0, n;
+	int t;
+
+	if (arena)
+		buddy_arena_set_release_order(arena, -1);	//giving memory back to the kernel would time madvise rather than the allocator
+
+	if (!ctxs || (timed && !lat) || !arena || !tids) {
+		free(ctxs);
+		free(lat);
+		free(tids);
+		buddy_arena_destroy(arena);
+		return false;
+	}
+
+	pthread_barrier_init(&start, NULL, threads);
+	for (t = 0; t < threads; t++) {
+		ctxs[t].arena = arena;
+		ctxs[t].order = order;
+		ctxs[t].threads = threads;
+		ctxs[t].ops = ops;
+		ctxs[t].lat = lat ? lat + (size_t)t * ops : NULL;
+		ctxs[t].seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+		ctxs[t].start = threads > 1 ? &start : NULL;
+		ctxs[t].fn = fn;
+	}
+
+	if (threads == 1)
+		fn(&ctxs[0]);
+	else {
+		for (t = 0; t < threads; t++)
+			pthread_create(&tids[t], NULL, bench_thread, &ctxs[t]);
+		for (t = 0; t < threads; t++)
+			pthread_join(tids[t], NULL);
+	}
+
+	for (t = 0; t < threads; t++) {
+		total += ctxs[t].done;
+		if (ctxs[t].elapsed_ns > elapsed)
+			elapsed = ctxs[t].elapsed_ns;
+	}
+
+	if (timed) {
+		//the threads may have run fewer operations than there is room for; pack their latencies together
+		for (n = 0, t = 0; t < threads; t++) {
+			long done = ctxs[t].done < ops ? ctxs[t].done : ops;
+
+			memmove(lat + n, ctxs[t].lat, done * sizeof(*lat));
+			n += done;
+		}
+		qsort(lat, n, sizeof(*lat), lat_cmp);
+		result->p50 = n ? lat[n * 50 / 100] : 0;
+		result->p99 = n ? lat[n * 99 / 100] : 0;
+		result->p999 = n ? lat[n * 999 / 1000] : 0;
+	}
+	else {
+		result->ns_per_op = total ? (double)elapsed * threads / total : 0;
+		result->ops_per_sec = elapsed ? total * 1e9 / elapsed : 0;
+	}
+
+	pthread_barrier_destroy(&start);
+	buddy_arena_destroy(arena);
+	free(tids);
+	free(lat);
+	free(ctxs);
+	return true;
+}
+
+//runs a benchmark for throughput and then for latency, and prints a line of results, unless its name is filtered out
+/*
+ * @param name name of the benchmark
+ * @param filter only benchmarks whose name contains this run. NULL runs all
+ * @param fn the benchmark
+ * @param flags BUDDY_ARENA_* flags of the arena
+ * @param order block order passed to the benchmark
+ * @param threads number of threads
+ * @param ops operations per thread
+ */
+static void bench_report(const char *name, const char *filter, bench_fn fn, unsigned flags, int order, int threads, long ops){
+	bench_result_t result;
+
+	if (filter && !strstr(name, filter))
+		return;
+
+	if (!bench_run(fn, flags, order, threads, ops, false, &result) || !bench_run(fn, flags, order, threads, ops, true, &result)) {
+		printf("%-36s out of memory\n", name);
+		return;
+	}
+	printf("%-36s %10.1f %10.2f %8u %8u %8u\n", name, result.ns_per_op, result.ops_per_sec / 1e6, result.p50, result.p99, result.p999);
+	fflush(stdout);
+}
+
+//smallest time between two clock reads, which every latency includes
+static uint64_t timer_overhead(){
+	uint64_t best = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		uint64_t t0 = now_ns();
+		uint64_t t1 = now_ns();
+
+		if (t1 - t0 < best)
+			best = t1 - t0;
+	}
+	return best;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-n ops] [-t threads] [-f filter]\n", prog_name);
+	fprintf(out, "     -n [optional] - Operations per benchmark and thread (default %d).\n", BENCH_DEFAULT_OPS);
+	fprintf(out, "     -t [optional] - Most threads for the multithreaded benchmarks (default %d).\n", BENCH_DEFAULT_THREADS);
+	fprintf(out, "     -f [optional] - Only run the benchmarks whose name contains filter.\n");
+}
+
+int main(int argc, char** argv)
+{
+	long ops = BENCH_DEFAULT_OPS;
+	int max_threads = BENCH_DEFAULT_THREADS;
+	const char *filter = NULL;
+	char name[64];
+	int opt, order, threads;
+
+	while ((opt = getopt(argc, argv, "n:t:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = atol(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (ops < 2 || max_threads < 1) {
+		print_usage(argv[0], stderr);
+		return EXIT_FAILURE;
+	}
+
+	printf("%ld operations per benchmark and thread, latencies include %lu ns of timer overhead\n\n", ops, (unsigned long)timer_overhead());
+	printf("%-36s %10s %10s %8s %8s %8s\n", "Benchmark", "ns/op", "Mops/s", "p50 ns", "p99 ns", "p99.9 ns");
+	printf("--------------------------------------------------------------------------------------\n");
+
+	for (order = BENCH_MIN_ORDER; order <= BENCH_MIN_ORDER + 8; order += 2) {
+		snprintf(name, sizeof(name), "pingpong/%zuK", ((size_t)1 << order) / 1024);
+		bench_report(name, filter, bench_pingpong, 0, order, 1, ops);
+	}
+	bench_report("churn", filter, bench_churn, 0, 0, 1, ops);
+	bench_report("fill_drain", filter, bench_fill, 0, 0, 1, ops);
+	bench_report("deep_split_merge", filter, bench_deep, 0, 0, 1, ops);
+	bench_report("deep_split_merge/lazy", filter, bench_deep, BUDDY_ARENA_LAZY, 0, 1, ops);
+
+	for (threads = 2; threads <= max_threads; threads *= 2) {
+		snprintf(name, sizeof(name), "mt/pingpong/4K/threads:%d", threads);
+		bench_report(name, filter, bench_pingpong, 0, BENCH_MIN_ORDER, threads, ops);
+		snprintf(name, sizeof(name), "mt/churn/threads:%d", threads);
+		bench_report(name, filter, bench_churn, 0, 0, threads, ops);
+		snprintf(name, sizeof(name), "mt_concurrent/pingpong/4K/threads:%d", threads);
+		bench_report(name, filter, bench_pingpong, BUDDY_ARENA_CONCURRENT, BENCH_MIN_ORDER, threads, ops);
+		snprintf(name, sizeof(name), "mt_concurrent/pingpong/8K/threads:%d", threads);
+		bench_report(name, filter, bench_pingpong, BUDDY_ARENA_CONCURRENT, BENCH_MIN_ORDER + 1, threads, ops);
+		snprintf(name, sizeof(name), "mt_concurrent/churn/threads:%d", threads);
+		bench_report(name, filter, bench_churn, BUDDY_ARENA_CONCURRENT, 0, threads, ops);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,7 +1,5 @@
 /**
  * Buddy Allocator
- *
- * For the list library usage, see http://www.mcs.anl.gov/~kazutomo/list/
  */
 
 /**************************************************************************
@@ -9,25 +7,32 @@
  **************************************************************************/
 #define USE_DEBUG 0
 
+#define _GNU_SOURCE	//for sched_getcpu
+
 /**************************************************************************
  * Included Files
  **************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "buddy.h"
-#include "list.h"
 #include <stdbool.h>
 
-#include <math.h>
-
 /**************************************************************************
  * Public Definitions
  **************************************************************************/
+/* configuration of the default arena used by buddy_init/buddy_alloc/buddy_free/buddy_dump */
 #define MIN_ORDER 12
 #define MAX_ORDER 20
 
-#define PAGE_SIZE (1<<MIN_ORDER)	
+#define PAGE_SIZE (1<<MIN_ORDER)
 
 /* total accessible memory space (in Bytes) */
 #define MEMORY_SIZE (1<<MAX_ORDER)
@@ -36,24 +41,66 @@
 #define NUM_OF_PAGES (MEMORY_SIZE/PAGE_SIZE)
 
 
+/* free single-page blocks kept on each CPU's lock-free stack of a concurrent arena before a free drains LF_BATCH of them to the free area */
+#define LF_HIGH 128
+
+/* number of single-page blocks moved between the lock-free stack and the free area at once */
+#define LF_BATCH 32
+
+/* per-CPU page caches of concurrent arenas hold blocks of the PCP_ORDERS lowest orders above the page size */
+#define PCP_ORDERS 4
+
+/* most blocks a per-CPU cache holds per order. A full cache drains PCP_BATCH blocks back to the free area */
+#define PCP_HIGH 64
+
+/* number of blocks moved between a per-CPU cache and the free area at once */
+#define PCP_BATCH 16
+
+/* page index ending a free list. Page indices are 32 bits wide, so arenas hold fewer pages than this */
+#define PAGE_NONE UINT32_MAX
+
+/* freed blocks a lazy arena keeps uncoalesced per order before a free coalesces the LAZY_BATCH oldest of them */
+#define LAZY_HIGH 64
+
+/* number of blocks coalesced at once when a lazy cache is over its watermark */
+#define LAZY_BATCH 16
+
+/* number of blocks at the head of a free list BUDDY_PLACEMENT_BUDDY_BUSY looks at for one whose buddy is split */
+#define PLACEMENT_SCAN 8
+
+/* upper bound on the words of the per-order free block bitmaps of n pages over the given number of orders */
+#define FREE_MAP_WORDS(n, orders) (2 * (n) / LONG_BITS + (orders))
+
+/* page size of an arena */
+#define ARENA_PAGE_SIZE(a) ((size_t)1 << (a)->min_order)
+
 /* page index to address */
-#define PAGE_TO_ADDR(page_idx) (void *)((page_idx*PAGE_SIZE) + g_memory)
+#define PAGE_TO_ADDR(a, page_idx) (void *)((a)->base + ((size_t)(page_idx) << (a)->min_order))
 
 /* address to page index */
-#define ADDR_TO_PAGE(addr) ((unsigned long)((void *)addr - (void *)g_memory) / PAGE_SIZE)
+#define ADDR_TO_PAGE(a, addr) ((long)((size_t)((char *)(addr) - (a)->base) >> (a)->min_order))
+
+/* number of bits in an unsigned long */
+#define LONG_BITS (8 * (int)sizeof(unsigned long))
+
+/* floor(log2(x)) for x > 0, computed with a count-leading-zeros instead of floating point */
+#define LOG2_FLOOR(x) ( LONG_BITS - 1 - __builtin_clzl((unsigned long)(x)) )
+
+/* ceil(log2(x)) for x > 1 */
+#define LOG2_CEIL(x) ( LONG_BITS - __builtin_clzl((unsigned long)(x) - 1) )
 
 /* find the block order based on the page index. */
-#define PAGE_TO_BLOCK_ORDER(page_idx) ( MAX_ORDER - (int)(log2f(page_idx + 1)) )
+#define PAGE_TO_BLOCK_ORDER(a, page_idx) ( (a)->max_order - LOG2_FLOOR((page_idx) + 1) )
 
 /* returns the index difference between two consecutive pages (say, a page and its buddy) in a given block order */
-#define BUDDY_OFFSET(o) ( NUM_OF_PAGES/(1<<(MAX_ORDER-o)) )
+#define BUDDY_OFFSET(a, o) ( 1L << ((o) - (a)->min_order) )
 
 /* find buddy address */  //Block order : o
-#define BUDDY_ADDR(addr, o) (void *)((((unsigned long)addr - (unsigned long)g_memory) ^ (1<<o)) \
-									 + (unsigned long)g_memory)
+#define BUDDY_ADDR(a, addr, o) (void *)((((unsigned long)addr - (unsigned long)(a)->base) ^ (1UL<<(o))) \
+									 + (unsigned long)(a)->base)
 
 /* checks if the given page index in the given block order is a buddy index (the L_R index)*/
-#define CHECK_IF_BUDDY(page_idx, o)( (page_idx/BUDDY_OFFSET(o))%2 )
+#define CHECK_IF_BUDDY(a, page_idx, o)( ((page_idx)/BUDDY_OFFSET(a, o))%2 )
 
 
 #if USE_DEBUG == 1
@@ -71,35 +118,139 @@
 /**************************************************************************
  * Public Types
  **************************************************************************/
+/*
+ * Page state, kept in a dense array of a few bytes per page so that walking the
+ * pages, and the buddy checks of split and merge, stay within few cache lines.
+ * The free list links live in a separate array (page_link_t).
+ */
 typedef struct {
-	struct list_head list;
-	int block_order;	//this field indicates in what block order the given page is allocated. If the page is free, this is set to -1
+	int8_t block_order;	//this field indicates the block order of the block headed by the given page, whether allocated or free. If the page heads no block, this is set to -1
+	bool is_free;		//true if the block headed by this page is sitting in free_area[block_order]
+	bool exact_more;	//true if the block headed by this page is part of an exact allocation that continues with the next block (see buddy_arena_alloc_exact)
+	bool is_lazy;		//true if the block headed by this page was freed but is parked uncoalesced in lazy_area[block_order]
 } page_t;
 
+/*
+ * Free list links of a page heading a free or lazily freed block, as page
+ * indices. Each list is circular, so the head's prev is the tail.
+ */
+typedef struct {
+	uint32_t prev;
+	uint32_t next;
+} page_link_t;
+
+/**
+ * Per-CPU cache of small blocks in front of a concurrent arena's free area.
+ * Cached blocks count as allocated as far as the buddy system is concerned
+ */
+typedef struct {
+	_Atomic uint64_t lf_head;		///< Lock-free stack of free single-page blocks: ABA tag in the high 32 bits, page index + 1 of the top block in the low 32 bits (0 if empty)
+	atomic_int lf_count;			///< Number of blocks on the lock-free stack. Updated right after each exchange, so pushes and pops in flight may make it lag, or even go negative, for a moment
+	pthread_mutex_t lock;			///< Guards the cached blocks below, not the stack. Rarely contended, since threads pick the cache of the CPU they run on
+	atomic_ulong allocs[PCP_ORDERS+1];	///< Blocks handed out from this CPU's stack and cache, per order starting at the arena's min_order. Their bytes granted follow from these
+	atomic_ulong frees[PCP_ORDERS+1];	///< Blocks freed into this CPU's stack and cache, per order starting at the arena's min_order
+	atomic_ulong bytes_requested;		///< Bytes asked for by the allocations counted in allocs
+	int count[PCP_ORDERS];			///< Number of cached blocks per order, starting at the arena's pcp_min_order
+	long pages[PCP_ORDERS][PCP_HIGH];	///< Page indices of the cached blocks, used as stacks
+} __attribute__((aligned(64))) buddy_pcp_t;
+
+/**
+ * Allocation statistics of an arena. Counters changed under the zone lock are
+ * written with relaxed stores, those the caches of concurrent arenas change
+ * with relaxed atomic adds, so buddy_arena_stats can read them at any time
+ * without taking a lock
+ */
+typedef struct {
+	atomic_ulong allocs[BUDDY_ORDER_LIMIT+1];	///< Blocks handed out, per block order
+	atomic_ulong frees[BUDDY_ORDER_LIMIT+1];	///< Blocks freed, per block order
+	atomic_ulong splits[BUDDY_ORDER_LIMIT+1];	///< Free blocks split, per block order. Under the zone lock
+	atomic_ulong merges[BUDDY_ORDER_LIMIT+1];	///< Buddy pairs merged, per block order. Under the zone lock
+	atomic_ulong failed;				///< Allocations that returned NULL
+	atomic_ulong bytes_requested;			///< Bytes asked for, over all allocations
+	atomic_ulong bytes_granted;			///< Bytes handed out for them
+	atomic_ulong in_use;				///< Bytes currently allocated
+	atomic_ulong peak_in_use;			///< Most bytes ever allocated at once
+} buddy_counters_t;
+
+/**
+ * A region of memory managed by its own buddy system
+ */
+struct buddy_arena {
+	char *base;		///< Start of the managed memory. Blocks are aligned relative to this address
+	size_t size;		///< Number of managed bytes, a multiple of the page size
+	int min_order;		///< Block order of a single page
+	int max_order;		///< Largest block order
+	long num_pages;		///< Number of pages in the arena
+	page_t *pages;		///< Page states, one per page
+	page_link_t *links;	///< Free list links, one per page
+	bool owns_pages;	///< Were the page states and links allocated by buddy_arena_create?
+	unsigned flags;		///< BUDDY_ARENA_* flags the arena was created with
+	size_t map_size;	///< Size of the mapping at base if the memory was mapped by buddy_arena_create_mmap, 0 otherwise
+	int release_order;	///< Free blocks that coalesce to at least this order are given back to the kernel. Above max_order if never
+
+	pthread_mutex_t lock;	///< Guards the page structures and free lists (the zone lock)
+	buddy_pcp_t *pcp;	///< Per-CPU caches, NULL unless the arena is BUDDY_ARENA_CONCURRENT
+	int num_pcp;		///< Number of per-CPU caches
+	int pcp_min_order;	///< Lowest block order held by the per-CPU caches
+	_Atomic uint32_t *lf_next;	///< Per page: page index + 1 of the block below it on its CPU's lock-free stack. NULL unless the stacks are in use
+
+	uint32_t free_area[BUDDY_ORDER_LIMIT+1];	///< Page index of the first block of each free list, indexed by block order. PAGE_NONE if empty
+	unsigned long free_area_mask;	///< Bit o is set if and only if free_area[o] is non-empty
+	long nr_free[BUDDY_ORDER_LIMIT+1];	///< Number of blocks on each free list
+
+	uint32_t lazy_area[BUDDY_ORDER_LIMIT+1];	///< BUDDY_ARENA_LAZY only: per block order, freed blocks not coalesced yet, oldest first. PAGE_NONE if empty
+	long lazy_count[BUDDY_ORDER_LIMIT+1];	///< Number of blocks in each lazy_area list
+
+	buddy_placement_t placement;	///< Which free block of an order is handed out
+	unsigned long *free_map;	///< Per-order bitmaps of the free blocks, bit i of order o standing for the block at page i << (o - min_order)
+	long free_map_start[BUDDY_ORDER_LIMIT+1];	///< Word offset of the bitmap of each order in free_map
+	long free_map_low[BUDDY_ORDER_LIMIT+1];	///< Per order: no bit is set below this word of its bitmap
+
+	buddy_reclaim_fn reclaim;	///< Called by buddy_arena_alloc before failing, NULL if none
+	void *reclaim_ctx;		///< Passed to reclaim
+
+	buddy_counters_t stats;		///< Allocation statistics
+};
+
 /**************************************************************************
  * Global Variables
  **************************************************************************/
-/* free lists*/
-struct list_head free_area[MAX_ORDER+1];
+/* memory area. aligned to its own size, so blocks are naturally aligned in absolute terms too */
+char g_memory[MEMORY_SIZE] __attribute__((aligned(MEMORY_SIZE)));
 
-/* memory area */
-char g_memory[MEMORY_SIZE]; 
+/* page states and free list links */
+page_t g_pages[(MEMORY_SIZE)/PAGE_SIZE];
+page_link_t g_links[(MEMORY_SIZE)/PAGE_SIZE];
+unsigned long g_free_map[FREE_MAP_WORDS(NUM_OF_PAGES, MAX_ORDER - MIN_ORDER + 1)];
 
-/* page structures */
-page_t g_pages[(MEMORY_SIZE)/PAGE_SIZE]; 
+/* the arena behind buddy_alloc/buddy_free/buddy_dump */
+static buddy_arena_t g_arena;
 
 
 
 /**************************************************************************
  * Public Function Prototypes
  **************************************************************************/
+void _buddy_free(buddy_arena_t *arena, int block_order, long page_index);
+static void *split_free_block(buddy_arena_t *arena, long page_index, int target_block_order);
 
-//rounds up x (in bytes) to the next power of 2, if not already a power of 2
-int roundup2(int x){
-	float log2x = log2f((float)x);
-	if(log2x != (int)log2x)
-		return 1<<(int)ceil(log2x);
-	return x;
+//rounds up x (in bytes) to the next power of 2, if not already a power of 2. x must not exceed the largest power of 2 a size_t can hold
+size_t roundup2(size_t x){
+	if(x <= 1)
+		return 1;
+	return (size_t)1 << LOG2_CEIL(x);
+}
+
+//maps a request size to the block order that serves it, i.e. the order of the smallest block (no smaller than a page) that can hold size bytes
+/*
+ * @param arena the arena serving the request
+ * @param size size in bytes - must not exceed the arena's largest block
+ * @return the block order
+ */
+static inline int size_to_block_order(buddy_arena_t *arena, size_t size){
+	if(size <= ARENA_PAGE_SIZE(arena))	//if the requested size is smaller than the page size then set it to the page size
+		return arena->min_order;
+	return LOG2_CEIL(size);
 }
 
 
@@ -108,228 +259,2098 @@ int roundup2(int x){
  * Local Functions
  **************************************************************************/
 
-/**
- * Initialize the buddy system
+//bumps a statistics counter only ever changed under the zone lock. A relaxed load and store is enough, and much cheaper than an atomic add
+static inline void stats_inc_locked(atomic_ulong *counter){
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+//adds to a statistics counter
+/*
+ * Plain arenas only count under the zone lock, so they make do with a relaxed
+ * load and store. The caches of concurrent arenas count without it and need
+ * an atomic add.
+ *
+ * @param arena the arena
+ * @param counter the counter
+ * @param n the amount to add
  */
-void buddy_init()
-{
+static inline void stats_add(buddy_arena_t *arena, atomic_ulong *counter, unsigned long n){
+	if(arena->pcp)
+		atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+	else
+		atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+//adjusts the bytes in use by delta, tracking the peak. Under the zone lock unless the arena is concurrent
+/*
+ * @param arena the arena
+ * @param delta bytes allocated, or freed if negative
+ */
+static inline void stats_in_use(buddy_arena_t *arena, long delta){
+	unsigned long peak = atomic_load_explicit(&arena->stats.peak_in_use, memory_order_relaxed);
+	unsigned long in_use;
+
+	if(arena->pcp)
+		in_use = atomic_fetch_add_explicit(&arena->stats.in_use, delta, memory_order_relaxed) + delta;
+	else {
+		in_use = atomic_load_explicit(&arena->stats.in_use, memory_order_relaxed) + delta;
+		atomic_store_explicit(&arena->stats.in_use, in_use, memory_order_relaxed);
+	}
+	while(in_use > peak && !atomic_compare_exchange_weak_explicit(&arena->stats.peak_in_use, &peak, in_use, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+//counts an allocation. Under the zone lock unless the arena is concurrent
+/*
+ * @param arena the arena
+ * @param block_order the block order allocated
+ * @param requested bytes asked for
+ * @param granted bytes handed out
+ */
+static void stats_alloc(buddy_arena_t *arena, int block_order, size_t requested, size_t granted){
+	stats_add(arena, &arena->stats.allocs[block_order], 1);
+	stats_add(arena, &arena->stats.bytes_requested, requested);
+	stats_add(arena, &arena->stats.bytes_granted, granted);
+	stats_in_use(arena, granted);
+}
+
+//counts a failed allocation. Failing is the slow path anyway, so this needs no lock
+static void stats_failed(buddy_arena_t *arena, unsigned long n){
+	atomic_fetch_add_explicit(&arena->stats.failed, n, memory_order_relaxed);
+}
+
+//counts a free. Under the zone lock unless the arena is concurrent
+/*
+ * @param arena the arena
+ * @param block_order the block order freed
+ * @param granted bytes the block had
+ */
+static void stats_free(buddy_arena_t *arena, int block_order, size_t granted){
+	stats_add(arena, &arena->stats.frees[block_order], 1);
+	stats_in_use(arena, -(long)granted);
+}
+
+//appends a page to a circular list of page indices linked through the arena's page links
+/*
+ * @param arena the arena owning the page
+ * @param head the head of the list, PAGE_NONE if empty
+ * @param page_index the index of the page
+ */
+static inline void page_list_add_tail(buddy_arena_t *arena, uint32_t *head, long page_index){
+	page_link_t *link = &arena->links[page_index];
+
+	if(*head == PAGE_NONE){
+		link->prev = link->next = page_index;
+		*head = page_index;
+	}
+	else{	//insert just before the head
+		link->prev = arena->links[*head].prev;
+		link->next = *head;
+		arena->links[link->prev].next = page_index;
+		arena->links[*head].prev = page_index;
+	}
+}
+
+//removes a page from a circular list of page indices in constant time
+/*
+ * @param arena the arena owning the page
+ * @param head the head of the list the page is on
+ * @param page_index the index of the page
+ */
+static inline void page_list_del(buddy_arena_t *arena, uint32_t *head, long page_index){
+	page_link_t *link = &arena->links[page_index];
+
+	if(link->next == page_index){	//the only page of its list
+		*head = PAGE_NONE;
+	}
+	else{
+		arena->links[link->prev].next = link->next;
+		arena->links[link->next].prev = link->prev;
+		if(*head == page_index)
+			*head = link->next;
+	}
+}
+
+//adds the block headed by page_index to the free area of the given block order, and marks it free
+/*
+ * @param arena the arena owning the page
+ * @param page_index the index of the page heading the free block
+ * @param block_order the block order of the free block
+ */
+static inline void free_area_add(buddy_arena_t *arena, long page_index, int block_order){
+	page_t *page = &arena->pages[page_index];
+
+	page_list_add_tail(arena, &arena->free_area[block_order], page_index);
+	arena->free_area_mask |= 1UL << block_order;
+	arena->nr_free[block_order]++;
+	page->block_order = block_order;
+	page->is_free = true;
+
+	long bit = page_index >> (block_order - arena->min_order);
+	arena->free_map[arena->free_map_start[block_order] + bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+	if(bit / LONG_BITS < arena->free_map_low[block_order])
+		arena->free_map_low[block_order] = bit / LONG_BITS;
+}
+
+//removes the free block headed by page_index from its free area in constant time. The page no longer heads any block afterwards.
+/*
+ * @param arena the arena owning the page
+ * @param page_index the index of the page heading the free block
+ */
+static inline void free_area_del(buddy_arena_t *arena, long page_index){
+	page_t *page = &arena->pages[page_index];
+	int block_order = page->block_order;
+
+	page_list_del(arena, &arena->free_area[block_order], page_index);
+	if(arena->free_area[block_order] == PAGE_NONE)
+		arena->free_area_mask &= ~(1UL << block_order);
+	arena->nr_free[block_order]--;
+
+	long bit = page_index >> (block_order - arena->min_order);
+	arena->free_map[arena->free_map_start[block_order] + bit / LONG_BITS] &= ~(1UL << (bit % LONG_BITS));
+
+	page->block_order = -1;
+	page->is_free = false;
+}
+
+//finds the free block of the given order at the lowest address
+/*
+ * @param arena the arena
+ * @param block_order the block order
+ * @return the index of the page heading the block, or -1 if there is no free block of that order
+ */
+static long free_area_lowest(buddy_arena_t *arena, int block_order){
+	unsigned long *map = arena->free_map + arena->free_map_start[block_order];
+	long w;
+
+	if(arena->free_area[block_order] == PAGE_NONE)
+		return -1;
+	for(w = arena->free_map_low[block_order]; !map[w]; w++)	//the list is non-empty, so some bit is set
+		;
+	arena->free_map_low[block_order] = w;
+	return (w * LONG_BITS + __builtin_ctzl(map[w])) << (block_order - arena->min_order);
+}
+
+//chooses the free block of the given order to hand out, according to the arena's placement policy
+/*
+ * @param arena the arena
+ * @param block_order a block order whose free list is non-empty
+ * @return the index of the page heading the chosen block. It is still on its free list
+ */
+static long free_area_pick(buddy_arena_t *arena, int block_order){
+	long head = arena->free_area[block_order];
+	long page_index;
 	int i;
-	for (i = 0; i < NUM_OF_PAGES; i++) {
-		INIT_LIST_HEAD(&g_pages[i].list);
-		g_pages[i].block_order = -1;	//initialize all pages to "free"
+
+	switch(arena->placement){
+	case BUDDY_PLACEMENT_LIFO:	//blocks are added at the tail
+		return arena->links[head].prev;
+
+	case BUDDY_PLACEMENT_ADDRESS:
+		return free_area_lowest(arena, block_order);
+
+	case BUDDY_PLACEMENT_BUDDY_BUSY:
+		if(block_order == arena->max_order)
+			return head;
+		//a block whose buddy is allocated whole coalesces as soon as that one block is freed, while a split buddy needs all its pieces back. so hand out the latter first
+		page_index = head;
+		for(i = 0; i < PLACEMENT_SCAN; i++){
+			long buddy_page_index = page_index + (CHECK_IF_BUDDY(arena, page_index, block_order) ? -BUDDY_OFFSET(arena, block_order) : BUDDY_OFFSET(arena, block_order));
+
+			if(buddy_page_index >= arena->num_pages)	//no buddy at all, so it never coalesces
+				return page_index;
+			if(arena->pages[buddy_page_index].block_order != block_order)	//the buddy does not head a block of this order: it is split
+				return page_index;
+			if((page_index = arena->links[page_index].next) == head)
+				break;
+		}
+		return head;
+
+	default:
+		return head;
+	}
+}
+
+//adds a block given back by an allocation to the free area, releasing its memory to the kernel if it is of the release order or above. Under the zone lock
+/*
+ * Every free block of the release order or above is released this way or by
+ * _buddy_free, which relies on it: it only releases what a free adds.
+ *
+ * @param arena the arena owning the block
+ * @param page_index the index of the page heading the block
+ * @param block_order the block order of the block
+ */
+static void free_area_release(buddy_arena_t *arena, long page_index, int block_order){
+	free_area_add(arena, page_index, block_order);
+	if(block_order >= arena->release_order)
+		madvise(PAGE_TO_ADDR(arena, page_index), (size_t)1 << block_order, MADV_DONTNEED);
+}
+
+//adds a range of pages to the free area as the largest blocks that are aligned at their offset and still fit in the range, releasing those of the release order or above
+/*
+ * @param arena the arena owning the pages
+ * @param first_page the index of the first page in the range
+ * @param end_page the index one past the last page in the range
+ */
+static void free_area_add_range(buddy_arena_t *arena, long first_page, long end_page){
+	long i;
+	int o;
+
+	for (i = first_page; i < end_page; ) {
+		o = arena->max_order;
+		while (o > arena->min_order && ((i & (BUDDY_OFFSET(arena, o) - 1)) || i + BUDDY_OFFSET(arena, o) > end_page))
+			o--;
+		free_area_release(arena, i, o);
+		i += BUDDY_OFFSET(arena, o);
+	}
+}
+
+//copies the number of free blocks of every order, under the zone lock
+/*
+ * @param arena the arena
+ * @param counts receives the number of free blocks per block order, BUDDY_ORDER_LIMIT+1 entries
+ */
+static void count_free_blocks(buddy_arena_t *arena, long *counts){
+	memcpy(counts, arena->nr_free, (BUDDY_ORDER_LIMIT + 1) * sizeof(*counts));
+}
+
+//sets up the buddy system of an arena over the given memory and page states
+/*
+ * @param arena the arena to initialize
+ * @param base start of the managed memory
+ * @param num_pages number of pages to manage
+ * @param min_order block order of a single page
+ * @param max_order largest block order
+ * @param pages page states, at least num_pages of them
+ * @param links free list links, at least num_pages of them
+ * @param free_map free block bitmaps, at least FREE_MAP_WORDS(num_pages, max_order - min_order + 1) words
+ */
+static void arena_init(buddy_arena_t *arena, void *base, long num_pages, int min_order, int max_order, page_t *pages, page_link_t *links, unsigned long *free_map){
+	long i;
+	int o;
+
+	arena->base = base;
+	arena->size = (size_t)num_pages << min_order;
+	arena->min_order = min_order;
+	arena->max_order = max_order;
+	arena->num_pages = num_pages;
+	arena->pages = pages;
+	arena->links = links;
+	arena->free_map = free_map;
+	arena->placement = BUDDY_PLACEMENT_FIFO;
+	arena->reclaim = NULL;
+	arena->reclaim_ctx = NULL;
+	memset(&arena->stats, 0, sizeof(arena->stats));
+	arena->owns_pages = false;
+	arena->flags = 0;
+	arena->pcp = NULL;
+	arena->num_pcp = 0;
+	arena->pcp_min_order = min_order;
+	arena->lf_next = NULL;
+	arena->map_size = 0;
+	arena->release_order = BUDDY_ORDER_LIMIT + 1;
+	pthread_mutex_init(&arena->lock, NULL);
+
+	for (i = 0; i < num_pages; i++) {
+		pages[i].block_order = -1;	//initially, no page heads a block
+		pages[i].is_free = false;
+		pages[i].exact_more = false;
+		pages[i].is_lazy = false;
 	}
 
 	/* initialize freelist */
-	for (i = MIN_ORDER; i <= MAX_ORDER; i++) { 
-		INIT_LIST_HEAD(&free_area[i]);  
+	for (o = 0; o <= BUDDY_ORDER_LIMIT; o++) {
+		arena->free_area[o] = PAGE_NONE;
+		arena->nr_free[o] = 0;
+		arena->lazy_area[o] = PAGE_NONE;
+		arena->lazy_count[o] = 0;
 	}
+	arena->free_area_mask = 0;
 
-	/* add the entire memory as a freeblock */
-	list_add(&g_pages[0].list, &free_area[MAX_ORDER]); 
-	
+	/* lay out the free block bitmaps, one bit per block of each order */
+	for (i = 0, o = min_order; o <= max_order; o++) {
+		arena->free_map_start[o] = i;
+		arena->free_map_low[o] = 0;
+		i += ((num_pages >> (o - min_order)) + LONG_BITS - 1) / LONG_BITS;
+	}
+	memset(free_map, 0, i * sizeof(*free_map));
+
+	/* add the entire memory as free blocks */
+	free_area_add_range(arena, 0, num_pages);
 }
 
+/**
+ * Initialize the buddy system
+ */
+void buddy_init()
+{
+	arena_init(&g_arena, g_memory, NUM_OF_PAGES, MIN_ORDER, MAX_ORDER, g_pages, g_links, g_free_map);
+}
 
-//inquires the free area for the available block order that is closest (lowest) to the desired order (target block order)
+//sets up the per-CPU lock-free stacks of single-page blocks and the per-CPU caches of a concurrent arena
 /*
- * @param block_order the desired block order - guaranteed to be greater than or equal to MIN_ORDER (the page size)
- * @return the lowest available block order
-*/
-int request_closest_free_block_order(int block_order){
+ * @param arena the arena
+ * @return false if out of memory
+ */
+static bool pcp_init(buddy_arena_t *arena){
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	long i;
 
-	while(block_order <= MAX_ORDER && list_empty(&free_area[block_order])){
-		block_order++;
-	}	
+	if(!(arena->lf_next = malloc(arena->num_pages * sizeof(*arena->lf_next))))
+		return false;
+	for(i = 0; i < arena->num_pages; i++)
+		atomic_init(&arena->lf_next[i], 0);
+	arena->pcp_min_order = arena->min_order + 1;
 
-	if(block_order > MAX_ORDER){
-		return -1;
+	arena->num_pcp = num_cpus > 0 ? (int)num_cpus : 1;
+	if(!(arena->pcp = aligned_alloc(64, arena->num_pcp * sizeof(buddy_pcp_t))))
+		return false;
+	for(i = 0; i < arena->num_pcp; i++){
+		atomic_init(&arena->pcp[i].lf_head, 0);
+		atomic_init(&arena->pcp[i].lf_count, 0);
+		memset(arena->pcp[i].allocs, 0, sizeof(arena->pcp[i].allocs));
+		memset(arena->pcp[i].frees, 0, sizeof(arena->pcp[i].frees));
+		atomic_init(&arena->pcp[i].bytes_requested, 0);
+		pthread_mutex_init(&arena->pcp[i].lock, NULL);
+		memset(arena->pcp[i].count, 0, sizeof(arena->pcp[i].count));
 	}
-	
-	return block_order;
+	return true;
 }
 
-//Allocates a block to memory by removing it from the free_area array. This is a helper function to buddy_alloc.
-/* @param starting_block_order the lowest block order that is capable of allocating memory
- * @param target_block_order the block order to which we ultimately want to make an allocation
- * @param size size in bytes
- * @return memory block address
-*/
-void *_buddy_alloc(int starting_block_order, int target_block_order){ 
-	
-	struct list_head* page_node;
-	int page_index;
-	void* mem_addr = NULL;
+/**
+ * Create an arena managing its own buddy system over caller-provided memory
+ *
+ * Blocks are aligned relative to base, so base should be aligned to
+ * 2^max_order for blocks to be naturally aligned in absolute terms (see
+ * buddy_arena_alloc_aligned). If size is not a multiple of 2^max_order, the
+ * tail is managed as smaller blocks. Pages are numbered with 32 bits, so an
+ * arena holds fewer than 2^32 pages.
+ *
+ * @param base start of the memory to manage
+ * @param size number of bytes to manage. Rounded down to a whole page
+ * @param min_order block order of a single page (the smallest block)
+ * @param max_order largest block order, at most BUDDY_ORDER_LIMIT
+ * @return the arena, or NULL if the parameters are invalid or out of memory
+ */
+buddy_arena_t *buddy_arena_create(void *base, size_t size, int min_order, int max_order)
+{
+	return buddy_arena_create_flags(base, size, min_order, max_order, 0);
+}
+
+/**
+ * Create an arena with optional behaviours
+ *
+ * Same as buddy_arena_create, but flags is a combination of BUDDY_ARENA_*
+ * values. With BUDDY_ARENA_CONCURRENT, single pages are served from a
+ * lock-free stack and blocks of the next few orders from per-CPU caches. Both
+ * refill from and drain to the free area in batches, so threads rarely contend
+ * on the arena's lock.
+ *
+ * With BUDDY_ARENA_LAZY, freed blocks are not coalesced right away but parked
+ * in a cache per order, and an allocation of the same order takes the most
+ * recently freed one back without splitting anything. Once a cache holds more
+ * than a watermark of blocks, a free coalesces the oldest ones; an allocation
+ * that would otherwise fail coalesces them all (see buddy_arena_drain).
+ *
+ * @param base start of the memory to manage
+ * @param size number of bytes to manage. Rounded down to a whole page
+ * @param min_order block order of a single page (the smallest block)
+ * @param max_order largest block order, at most BUDDY_ORDER_LIMIT
+ * @param flags BUDDY_ARENA_* flags
+ * @return the arena, or NULL if the parameters are invalid or out of memory
+ */
+buddy_arena_t *buddy_arena_create_flags(void *base, size_t size, int min_order, int max_order, unsigned flags)
+{
+	buddy_arena_t *arena;
+	page_t *pages;
+	page_link_t *links;
+	unsigned long *free_map;
+	long num_pages;
 
-	if(!(page_node = (&free_area[starting_block_order])->next)){	//get the first available list_head associated with this block order
+	if(!base || min_order < 1 || min_order > max_order || max_order > BUDDY_ORDER_LIMIT)
+		return NULL;
+
+	num_pages = (long)(size >> min_order);
+	if(num_pages == 0 || num_pages >= PAGE_NONE)
+		return NULL;
+
+	if(!(arena = malloc(sizeof(*arena))))
+		return NULL;
+	pages = malloc(num_pages * sizeof(*pages));
+	links = malloc(num_pages * sizeof(*links));
+	free_map = malloc(FREE_MAP_WORDS(num_pages, max_order - min_order + 1) * sizeof(*free_map));
+	if(!pages || !links || !free_map){
+		free(pages);
+		free(links);
+		free(free_map);
+		free(arena);
 		return NULL;
-	}		
-	page_index = (int)((page_t*)page_node - &g_pages[0]); //get the page index corresponding to this list_head
-	
-	list_del(page_node); //this block order will no longer be free upon allocation, therefore delete it from the free area
-	
-	//add all the required buddies, at each block order
-	for(int block_order = starting_block_order-1; block_order >= target_block_order; --block_order){
-		#if TESTING
-			printf("	buddy created %p at index %d, at block order %d\n", &g_pages[page_index + BUDDY_OFFSET(block_order)].list, page_index + BUDDY_OFFSET(block_order), block_order);
-		#endif	
-		list_add_tail(&g_pages[page_index + BUDDY_OFFSET(block_order)].list, &free_area[block_order]); //add its buddy	
 	}
 
-	mem_addr = PAGE_TO_ADDR(page_index);	//the memory address of the allocated block
-	g_pages[page_index].block_order = target_block_order;	//we just allocated memory to page_index at this block order, so set this field (used later by buddy_free())
-	
-	#if TESTING
-		printf("	allocated to addr %p, at block order %d, at page index %d\n", (int*)mem_addr, target_block_order, page_index);	
-	#endif
-	
-	return mem_addr;
-}
+	arena_init(arena, base, num_pages, min_order, max_order, pages, links, free_map);
+	arena->owns_pages = true;
+	arena->flags = flags;
+
+	if((flags & BUDDY_ARENA_CONCURRENT) && !pcp_init(arena)){
+		buddy_arena_destroy(arena);
+		return NULL;
+	}
 
+	return arena;
+}
 
 /**
- * Allocate a memory block.
+ * Destroy an arena created by buddy_arena_create
  *
- * On a memory request, the allocator returns the head of a free-list of the
- * matching size (i.e., smallest block that satisfies the request). If the
- * free-list of the matching block size is empty, then a larger block size will
- * be selected. The selected (large) block is then splitted into two smaller
- * blocks. Among the two blocks, left block will be used for allocation or be
- * further splitted while the right block will be added to the appropriate
- * free-list.
+ * The managed memory itself belongs to the caller and is left untouched.
  *
- * @param size size in bytes
- * @return memory block address
+ * @param arena the arena to destroy. May be NULL
  */
-void *buddy_alloc(int size)
+void buddy_arena_destroy(buddy_arena_t *arena)
 {
-	
-	#if TESTING
-		printf("REQUESTED: %.2fKB\n", (float)size/1024);
-	#endif
-	
-	int alloc_bytes;
-	
-	//if the requested size is smaller than the page size then set it to the page size
-	if(size <= PAGE_SIZE)
-		alloc_bytes = PAGE_SIZE;
-	else	
-	 	alloc_bytes = roundup2(size);
-
-	
-	int target_block_order = log2f(alloc_bytes); //the (starting) free block order to search a free spot in
-	
-	
-	void *mem_addr_allocd = NULL;
-	
-	//get the lowest block_order that supports allocation. -1 is returned if none is available.
-	int starting_block_order = request_closest_free_block_order(target_block_order);
-	
-	//allocate memory if allowed
-	if(starting_block_order != -1)
-		mem_addr_allocd = _buddy_alloc(starting_block_order, target_block_order);
+	int i;
 
-	#if TESTING
-		printf("ALLOCATED: %dKB\n", (mem_addr_allocd ? alloc_bytes : 0)/1024 );
-	#endif
-	
-	return mem_addr_allocd;
+	if(!arena || arena == &g_arena)
+		return;
+	for(i = 0; i < arena->num_pcp; i++)
+		pthread_mutex_destroy(&arena->pcp[i].lock);
+	free(arena->pcp);
+	free(arena->lf_next);
+	pthread_mutex_destroy(&arena->lock);
+	if(arena->owns_pages){
+		free(arena->pages);
+		free(arena->links);
+		free(arena->free_map);
+	}
+	if(arena->map_size)
+		munmap(arena->base, arena->map_size);
+	free(arena);
 }
 
-//iteratively frees block orders upwards, as long as the buddy of the freeable page index is also free. If not, it will stop, and no longer iterate. 
-/*
- * @param block_order the block order than contains the freeable page
- * @return page_index the index of the freeable page
+/**
+ * Create an arena over memory of its own, mapped from the kernel
+ *
+ * The whole size is reserved as address space up front, aligned to
+ * 2^max_order, but the kernel only commits physical pages once they are first
+ * touched, which the allocator itself never does since its bookkeeping lives
+ * outside the mapping. Memory therefore follows what has actually been handed
+ * out and used. Free blocks that coalesce up to BUDDY_HUGE_PAGE_ORDER (or
+ * max_order if smaller) are given back with MADV_DONTNEED, so memory is
+ * returned in 2MB granules even when max_order is much larger; see
+ * buddy_arena_set_release_order. The mapping is removed by buddy_arena_destroy.
+ *
+ * With BUDDY_ARENA_HUGEPAGE, the arena is backed by transparent huge pages
+ * (MADV_HUGEPAGE): max_order is raised to at least BUDDY_HUGE_PAGE_ORDER, size
+ * is rounded up to whole huge pages, and memory is only released in whole huge
+ * pages. Allocation already prefers the smallest free block that fits, so an
+ * intact huge page is only split once no smaller free block can serve the
+ * request; buddy_arena_intact_blocks(arena, BUDDY_HUGE_PAGE_ORDER) reports how
+ * many are left.
+ *
+ * @param size number of bytes to manage. Rounded up to a whole page
+ * @param min_order block order of a single page (the smallest block)
+ * @param max_order largest block order, at most BUDDY_ORDER_LIMIT
+ * @param flags BUDDY_ARENA_* flags, as for buddy_arena_create_flags
+ * @return the arena, or NULL if the parameters are invalid or out of memory
  */
-void _buddy_free(int block_order, int page_index){
-		
-	int buddy_page_index;
-	struct list_head* page_node = NULL;
-	bool buddy_is_free = true;
-	
-	//if the buddy is free, remove it and redo at the next block level
-	while(buddy_is_free && block_order <= MAX_ORDER){
-		buddy_is_free = false;
-		buddy_page_index = page_index + (CHECK_IF_BUDDY(page_index, block_order) ? -BUDDY_OFFSET(block_order) : BUDDY_OFFSET(block_order)); //get the page index of the buddy based on this page's index
-		list_for_each( page_node, &free_area[block_order] ){
-			if((page_t*)page_node == &g_pages[buddy_page_index]){	//if the buddy was found (in this order)	
-				#if TESTING
-					printf("	freeing buddy %p at block order %d, at page index %d, which is the buddy of page index %d\n", page_node, block_order, buddy_page_index, page_index);
-				#endif
-				list_del(page_node); 	//delete this page's buddy
-				g_pages[buddy_page_index].block_order = -1;	//the buddy page is now free -> -1
-				page_index = (buddy_page_index < page_index ? buddy_page_index : page_index); //set the appropriate page index in the next block order (up). used in the next iteration.
-				buddy_is_free = true;
-				block_order++;				
-				break;
-			}
-		}
-	}		
+buddy_arena_t *buddy_arena_create_mmap(size_t size, int min_order, int max_order, unsigned flags)
+{
+	buddy_arena_t *arena;
+	char *map, *base;
+	size_t align, map_len;
 
-	//once no more buddies remain, add the freed block to the free area
-	list_add_tail(&g_pages[page_index].list, &free_area[block_order]); //free this page
-	g_pages[page_index].block_order = -1;	//this page is now free -> -1
+	if((flags & BUDDY_ARENA_HUGEPAGE) && max_order < BUDDY_HUGE_PAGE_ORDER)
+		max_order = BUDDY_HUGE_PAGE_ORDER;
+
+	if(min_order < 1 || min_order > max_order || max_order > BUDDY_ORDER_LIMIT || size == 0)
+		return NULL;
+
+	align = (size_t)1 << ((flags & BUDDY_ARENA_HUGEPAGE) ? BUDDY_HUGE_PAGE_ORDER : min_order);	//granularity of the size
+	size = (size + align - 1) & ~(align - 1);
+	align = (size_t)1 << max_order;
+	map_len = size + align;	//room to slide the start up to an aligned address
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+
+	//keep the aligned part only
+	base = (char *)(((unsigned long)map + align - 1) & ~(align - 1));
+	if(base > map)
+		munmap(map, base - map);
+	if(map + map_len > base + size)
+		munmap(base + size, (map + map_len) - (base + size));
+
+	if(flags & BUDDY_ARENA_HUGEPAGE)
+		madvise(base, size, MADV_HUGEPAGE);	//best effort: without THP support the arena still works on small pages
+
+	if(!(arena = buddy_arena_create_flags(base, size, min_order, max_order, flags))){
+		munmap(base, size);
+		return NULL;
+	}
+	arena->map_size = size;
+	buddy_arena_set_release_order(arena, max_order < BUDDY_HUGE_PAGE_ORDER ? max_order : BUDDY_HUGE_PAGE_ORDER);
 
+	return arena;
 }
 
 /**
- * Free an allocated memory block.
+ * Set the order from which free blocks are given back to the kernel
  *
- * Whenever a block is freed, the allocator checks its buddy. If the buddy is
- * free as well, then the two buddies are combined to form a bigger block. This
- * process continues until one of the buddies is not free.
+ * Whenever a free coalesces a block of at least this order, the block of this
+ * order around the freed one is released with MADV_DONTNEED: its pages stop
+ * counting towards the resident size and read back as zeroes once allocated
+ * again. Larger buddies it merges with were released when they became free. Only meaningful for memory
+ * that is not needed across frees, which is why only buddy_arena_create_mmap
+ * enables it by default. Orders below the kernel page size are raised to it.
  *
- * @param addr memory block address to be freed
+ * @param arena the arena
+ * @param order the lowest order to release, or -1 to never release
  */
-void buddy_free(void *addr)
+void buddy_arena_set_release_order(buddy_arena_t *arena, int order)
 {
+	int kernel_page_order = LOG2_FLOOR(sysconf(_SC_PAGESIZE));
 
-	int page_index = ADDR_TO_PAGE(addr);	//page index of the freeable address
-	int block_order = g_pages[page_index].block_order;	//block order of the freeable page
-	
-	#if TESTING
+	pthread_mutex_lock(&arena->lock);
+	if(order < 0)
+		arena->release_order = BUDDY_ORDER_LIMIT + 1;
+	else
+		arena->release_order = order < kernel_page_order ? kernel_page_order : order;
+	if((arena->flags & BUDDY_ARENA_HUGEPAGE) && arena->release_order < BUDDY_HUGE_PAGE_ORDER)
+		arena->release_order = BUDDY_HUGE_PAGE_ORDER;	//releasing part of a huge page would split it
+	pthread_mutex_unlock(&arena->lock);
+}
 
-		if(!addr || g_pages[page_index].block_order == -1){
-			fprintf(stderr, "Error: Attempted to free a NULL address.\n");
-			exit(EXIT_FAILURE);
-		}
-		
-		if( page_index < 0 || page_index >= NUM_OF_PAGES ){
-			fprintf(stderr, "Error: Attempted to free an OUT-OF-BOUNDS Address (%p). The valid address range is from %p to %p.\n", (int*)addr, &g_memory[0], &g_memory[MEMORY_SIZE - 1]);
-			exit(EXIT_FAILURE);
-		} 
-		
-		printf("FREEING addr %p\n",  (int*)addr);	
-		/* Make sure we're not double freeing. For Testing Purposes (Although, probably a good thing to have in general, just like the real free() function does) */
-		struct list_head* page_node = NULL;
-		list_for_each( page_node, &free_area[block_order] ){
-			if((page_t*)page_node == &g_pages[page_index]){
-				fprintf(stderr, "Error: Attempted a double free at addr %p, block order %d, page index %d\n", (int*)addr, block_order, page_index);
-				exit(EXIT_FAILURE);
-			}
-		}
-	
-	#endif
-	
-		//free the page and buddies iteratively
-		_buddy_free(block_order, page_index);
+/**
+ * Count the naturally aligned blocks of a given order that are entirely free
+ *
+ * A free block of a higher order counts as several. With order
+ * BUDDY_HUGE_PAGE_ORDER, this is the number of huge pages no allocation has
+ * broken up.
+ *
+ * @param arena the arena
+ * @param order the block order
+ * @return the number of intact blocks
+ */
+long buddy_arena_intact_blocks(buddy_arena_t *arena, int order)
+{
+	long counts[BUDDY_ORDER_LIMIT+1];
+	long intact = 0;
+	int o;
+
+	if(order < arena->min_order)
+		order = arena->min_order;
+
+	pthread_mutex_lock(&arena->lock);
+	count_free_blocks(arena, counts);
+	pthread_mutex_unlock(&arena->lock);
+
+	for(o = order; o <= arena->max_order; o++)
+		intact += counts[o] << (o - order);
 
+	return intact;
 }
 
 /**
- * Print the buddy system status---order oriented
+ * Choose which free block of an order an arena hands out
  *
- * print free pages in each order.
+ * The default, BUDDY_PLACEMENT_FIFO, reuses the block freed longest ago.
+ * BUDDY_PLACEMENT_LIFO reuses the block freed last, whose memory is most
+ * likely still cached. BUDDY_PLACEMENT_ADDRESS hands out the block at the
+ * lowest address, packing live blocks towards the start of the arena so the
+ * end can coalesce into large blocks. BUDDY_PLACEMENT_BUDDY_BUSY prefers a
+ * block whose buddy is split into partly allocated pieces: such a block is far
+ * from coalescing anyway, while one whose buddy is allocated whole coalesces
+ * as soon as that block is freed, so it is spared. Per-CPU caches of
+ * concurrent arenas keep their own LIFO order.
+ *
+ * @param arena the arena
+ * @param placement the placement policy
  */
-void buddy_dump()
+void buddy_arena_set_placement(buddy_arena_t *arena, buddy_placement_t placement)
 {
-	int o;
-	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
-		struct list_head *pos;
-		int cnt = 0;
-		list_for_each(pos, &free_area[o]) {
-			cnt++;
-		}
-		printf("%d:%dK ", cnt, (1<<o)/1024);
-	}
-	printf("\n");
+	pthread_mutex_lock(&arena->lock);
+	arena->placement = placement;
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * Fragmentation index of the free memory of an arena
+ *
+ * Defined as 1 - largest free block / total free memory: 0 when all free
+ * memory is a single block (or there is none), approaching 1 as it is
+ * scattered over many small blocks. Blocks held in per-CPU caches are not
+ * counted as free.
+ *
+ * @param arena the arena
+ * @return the fragmentation index, between 0 and 1
+ */
+double buddy_arena_fragmentation(buddy_arena_t *arena)
+{
+	long counts[BUDDY_ORDER_LIMIT+1];
+	size_t total = 0, largest = 0;
+	int o;
+
+	pthread_mutex_lock(&arena->lock);
+	count_free_blocks(arena, counts);
+	pthread_mutex_unlock(&arena->lock);
+
+	for(o = arena->min_order; o <= arena->max_order; o++){
+		total += (size_t)counts[o] << o;
+		if(counts[o])
+			largest = (size_t)1 << o;
+	}
+
+	return total ? 1.0 - (double)largest / total : 0.0;
+}
+
+/**
+ * Take a snapshot of the allocation statistics of an arena
+ *
+ * The counters are kept up to date by every allocation and free at little
+ * cost, and read without locking, so this may be called at any time, e.g. by
+ * a monitoring thread. Each counter is exact, but counters read while other
+ * threads allocate may be a few operations apart from each other. Blocks in
+ * per-CPU and lazy caches count as allocated for splits, merges and free
+ * blocks, and as freed for everything else. Bulk allocations carve blocks without counting
+ * splits.
+ *
+ * @param arena the arena
+ * @param stats receives the snapshot
+ */
+void buddy_arena_stats(buddy_arena_t *arena, buddy_stats_t *stats)
+{
+	unsigned long free_area_mask = __atomic_load_n(&arena->free_area_mask, __ATOMIC_RELAXED);
+	int i, o;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->min_order = arena->min_order;
+	stats->max_order = arena->max_order;
+	for(o = arena->min_order; o <= arena->max_order; o++){
+		stats->allocs[o] = atomic_load_explicit(&arena->stats.allocs[o], memory_order_relaxed);
+		stats->frees[o] = atomic_load_explicit(&arena->stats.frees[o], memory_order_relaxed);
+		stats->splits[o] = atomic_load_explicit(&arena->stats.splits[o], memory_order_relaxed);
+		stats->merges[o] = atomic_load_explicit(&arena->stats.merges[o], memory_order_relaxed);
+		stats->free_blocks[o] = __atomic_load_n(&arena->nr_free[o], __ATOMIC_RELAXED);
+	}
+	stats->failed = atomic_load_explicit(&arena->stats.failed, memory_order_relaxed);
+	stats->bytes_requested = atomic_load_explicit(&arena->stats.bytes_requested, memory_order_relaxed);
+	stats->bytes_granted = atomic_load_explicit(&arena->stats.bytes_granted, memory_order_relaxed);
+	stats->in_use = atomic_load_explicit(&arena->stats.in_use, memory_order_relaxed);
+	stats->peak_in_use = atomic_load_explicit(&arena->stats.peak_in_use, memory_order_relaxed);
+
+	//add what the per-CPU stacks and caches counted
+	for(i = 0; i < arena->num_pcp; i++){
+		buddy_pcp_t *pcp = &arena->pcp[i];
+
+		for(o = arena->min_order; o <= arena->max_order && o - arena->min_order <= PCP_ORDERS; o++){
+			unsigned long allocs = atomic_load_explicit(&pcp->allocs[o - arena->min_order], memory_order_relaxed);
+
+			stats->allocs[o] += allocs;
+			stats->frees[o] += atomic_load_explicit(&pcp->frees[o - arena->min_order], memory_order_relaxed);
+			stats->bytes_granted += (size_t)allocs << o;
+		}
+		stats->bytes_requested += atomic_load_explicit(&pcp->bytes_requested, memory_order_relaxed);
+	}
+	stats->largest_free_order = free_area_mask ? LOG2_FLOOR(free_area_mask) : -1;
+}
+
+/**
+ * Register a callback that makes room when an allocation fails
+ *
+ * buddy_arena_alloc calls it, without any arena lock held, once no free block
+ * can serve a request, and retries if it reports success. The callback may
+ * allocate and free on the arena itself, but those nested allocations may call
+ * it again, so it must guard against reentry.
+ *
+ * @param arena the arena
+ * @param reclaim the callback, returning nonzero if it freed anything. NULL removes it
+ * @param ctx passed to the callback
+ */
+void buddy_arena_set_reclaim(buddy_arena_t *arena, buddy_reclaim_fn reclaim, void *ctx)
+{
+	pthread_mutex_lock(&arena->lock);
+	arena->reclaim = reclaim;
+	arena->reclaim_ctx = ctx;
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * Look up the callback registered with buddy_arena_set_reclaim
+ *
+ * Lets a component that registers its own callback remember the one it
+ * replaces, to chain to it and to put it back afterwards.
+ *
+ * @param arena the arena
+ * @param reclaim receives the callback, NULL if none
+ * @param ctx receives its context
+ */
+void buddy_arena_get_reclaim(buddy_arena_t *arena, buddy_reclaim_fn *reclaim, void **ctx)
+{
+	pthread_mutex_lock(&arena->lock);
+	*reclaim = arena->reclaim;
+	*ctx = arena->reclaim_ctx;
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/**
+ * Start of the memory managed by an arena
+ *
+ * @param arena the arena
+ * @return the base address
+ */
+void *buddy_arena_base(buddy_arena_t *arena)
+{
+	return arena->base;
+}
+
+/**
+ * Number of bytes managed by an arena
+ *
+ * @param arena the arena
+ * @return the size in bytes
+ */
+size_t buddy_arena_size(buddy_arena_t *arena)
+{
+	return arena->size;
+}
+
+/**
+ * Size of a page, the smallest block, of an arena
+ *
+ * @param arena the arena
+ * @return the page size in bytes
+ */
+size_t buddy_arena_page_size(buddy_arena_t *arena)
+{
+	return ARENA_PAGE_SIZE(arena);
+}
+
+/**
+ * Start of the arena page an address falls in
+ *
+ * Every block starts at a page boundary, so this tells block addresses apart
+ * from addresses inside a block.
+ *
+ * @param arena the arena
+ * @param addr an address inside the arena's memory
+ * @return the address of the page containing addr
+ */
+void *buddy_arena_page_start(buddy_arena_t *arena, const void *addr)
+{
+	return PAGE_TO_ADDR(arena, ADDR_TO_PAGE(arena, addr));
+}
+
+/**
+ * The arena behind buddy_alloc/buddy_free/buddy_dump
+ *
+ * @return the default arena. It is usable once buddy_init has been called
+ */
+buddy_arena_t *buddy_default_arena()
+{
+	return &g_arena;
+}
+
+
+//inquires the free area for the available block order that is closest (lowest) to the desired order (target block order)
+/*
+ * @param arena the arena to search
+ * @param block_order the desired block order - guaranteed to be greater than or equal to the arena's min_order (the page size)
+ * @return the lowest available block order
+*/
+int request_closest_free_block_order(buddy_arena_t *arena, int block_order){
+
+	unsigned long candidates = arena->free_area_mask >> block_order;	//non-empty block orders at or above the desired one
+
+	if(block_order > arena->max_order || !candidates){
+		return -1;
+	}
+
+	return block_order + __builtin_ctzl(candidates);
+}
+
+//Allocates a block to memory by removing it from the free_area array. This is a helper function to buddy_alloc.
+/* @param arena the arena to allocate from
+ * @param starting_block_order the lowest block order that is capable of allocating memory
+ * @param target_block_order the block order to which we ultimately want to make an allocation
+ * @return memory block address
+*/
+void *_buddy_alloc(buddy_arena_t *arena, int starting_block_order, int target_block_order){
+
+	if(arena->free_area[starting_block_order] == PAGE_NONE){	//make sure there is an available block at this block order
+		return NULL;
+	}
+
+	return split_free_block(arena, free_area_pick(arena, starting_block_order), target_block_order);	//split the available block the placement policy prefers at this block order
+}
+
+//Allocates the left-most piece of the given target order of a given free block, returning the other pieces to the free area. This is a helper function to _buddy_alloc.
+/* @param arena the arena to allocate from
+ * @param page_index the index of the page heading the free block
+ * @param target_block_order the block order to which we ultimately want to make an allocation
+ * @return memory block address
+*/
+static void *split_free_block(buddy_arena_t *arena, long page_index, int target_block_order){
+
+	int starting_block_order = arena->pages[page_index].block_order;
+	void* mem_addr = NULL;
+
+	free_area_del(arena, page_index); //this block order will no longer be free upon allocation, therefore delete it from the free area
+
+	//add all the required buddies, at each block order
+	for(int block_order = starting_block_order-1; block_order >= target_block_order; --block_order){
+		#if TESTING
+			printf("	buddy created %p at index %ld, at block order %d\n", PAGE_TO_ADDR(arena, page_index + BUDDY_OFFSET(arena, block_order)), page_index + BUDDY_OFFSET(arena, block_order), block_order);
+		#endif
+		free_area_add(arena, page_index + BUDDY_OFFSET(arena, block_order), block_order); //add its buddy
+		stats_inc_locked(&arena->stats.splits[block_order + 1]);
+	}
+
+	mem_addr = PAGE_TO_ADDR(arena, page_index);	//the memory address of the allocated block
+	arena->pages[page_index].block_order = target_block_order;	//we just allocated memory to page_index at this block order, so set this field (used later by buddy_free())
+
+	#if TESTING
+		printf("	allocated to addr %p, at block order %d, at page index %ld\n", (int*)mem_addr, target_block_order, page_index);
+	#endif
+
+	return mem_addr;
+}
+
+
+//is the arena in lazy coalescing mode?
+static inline bool lazy_arena(buddy_arena_t *arena){
+	return arena->flags & BUDDY_ARENA_LAZY;
+}
+
+//does the arena park blocks outside the free area, in per-CPU or lazy caches?
+static inline bool arena_caches(buddy_arena_t *arena){
+	return arena->pcp || lazy_arena(arena);
+}
+
+//coalesces up to n of the oldest blocks of a lazy cache into the free area, under the zone lock
+/*
+ * @param arena the arena
+ * @param block_order the block order of the cache
+ * @param n number of blocks to coalesce
+ */
+static void lazy_drain(buddy_arena_t *arena, int block_order, long n){
+	long page_index;
+
+	while(n-- > 0 && (page_index = arena->lazy_area[block_order]) != PAGE_NONE){
+		page_list_del(arena, &arena->lazy_area[block_order], page_index);
+		arena->lazy_count[block_order]--;
+		arena->pages[page_index].is_lazy = false;
+		_buddy_free(arena, block_order, page_index);
+	}
+}
+
+//parks a freed block uncoalesced in the lazy cache of its order, coalescing the oldest ones when over the watermark, under the zone lock
+/*
+ * @param arena the arena owning the block
+ * @param block_order the block order of the block
+ * @param page_index the index of the page heading the block
+ */
+static void lazy_free(buddy_arena_t *arena, int block_order, long page_index){
+	if(arena->lazy_count[block_order] >= LAZY_HIGH)
+		lazy_drain(arena, block_order, LAZY_BATCH);
+	page_list_add_tail(arena, &arena->lazy_area[block_order], page_index);
+	arena->lazy_count[block_order]++;
+	arena->pages[page_index].is_lazy = true;
+}
+
+//takes the most recently freed block off the lazy cache of an order, under the zone lock
+/*
+ * @param arena the arena
+ * @param block_order the block order wanted
+ * @return memory block address, or NULL if the cache is empty
+ */
+static void *lazy_alloc(buddy_arena_t *arena, int block_order){
+	long page_index;
+
+	if(arena->lazy_area[block_order] == PAGE_NONE)
+		return NULL;
+	page_index = arena->links[arena->lazy_area[block_order]].prev;	//the tail, still warm in cache
+	page_list_del(arena, &arena->lazy_area[block_order], page_index);
+	arena->lazy_count[block_order]--;
+	arena->pages[page_index].is_lazy = false;
+
+	return PAGE_TO_ADDR(arena, page_index);
+}
+
+//allocates a block of the given order carved from the start of a free block of at least split_block_order, under the zone lock
+/*
+ * A free block of order o starts at an offset that is a multiple of 2^o, so
+ * the block returned is aligned to 2^split_block_order relative to the base.
+ *
+ * @param arena the arena to allocate from
+ * @param target_block_order the block order to allocate
+ * @param split_block_order the lowest order of the free block to split, at least target_block_order
+ * @param requested bytes asked for, counted in the statistics. 0 if the caller counts the allocation itself
+ * @return memory block address, or NULL if no block is large enough
+ */
+static void *arena_alloc_order_from(buddy_arena_t *arena, int target_block_order, int split_block_order, size_t requested){
+	void *mem_addr = NULL;
+
+	pthread_mutex_lock(&arena->lock);
+
+	//a lazy arena first reuses a block of this very order that was freed recently, which needs no split
+	if(lazy_arena(arena) && split_block_order == target_block_order)
+		mem_addr = lazy_alloc(arena, target_block_order);
+
+	//get the lowest block_order that supports allocation. -1 is returned if none is available.
+	int starting_block_order = mem_addr ? -1 : request_closest_free_block_order(arena, split_block_order);
+
+	//allocate memory if allowed. _buddy_alloc keeps the left-most piece of the block it splits
+	if(starting_block_order != -1)
+		mem_addr = _buddy_alloc(arena, starting_block_order, target_block_order);
+
+	if(mem_addr && requested)
+		stats_alloc(arena, target_block_order, requested, (size_t)1 << target_block_order);
+
+	pthread_mutex_unlock(&arena->lock);
+
+	return mem_addr;
+}
+
+//allocates a block of the given order straight from the free area, under the zone lock
+/*
+ * @param arena the arena to allocate from
+ * @param target_block_order the block order to allocate
+ * @param requested bytes asked for, as for arena_alloc_order_from
+ * @return memory block address, or NULL if no block is large enough
+ */
+static void *arena_alloc_order(buddy_arena_t *arena, int target_block_order, size_t requested){
+	return arena_alloc_order_from(arena, target_block_order, target_block_order, requested);
+}
+
+//returns the cache of the CPU the calling thread is running on
+static inline buddy_pcp_t *this_cpu_pcp(buddy_arena_t *arena){
+	int cpu = sched_getcpu();
+
+	return &arena->pcp[(cpu < 0 ? 0 : cpu) % arena->num_pcp];
+}
+
+//counts an allocation served by a per-CPU stack or cache. Only in_use is shared, the other counters stay on the calling CPU's cache line
+/*
+ * @param arena the arena
+ * @param block_order the block order allocated
+ * @param requested bytes asked for
+ */
+static void stats_alloc_cached(buddy_arena_t *arena, int block_order, size_t requested){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+
+	atomic_fetch_add_explicit(&pcp->allocs[block_order - arena->min_order], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&pcp->bytes_requested, requested, memory_order_relaxed);
+	stats_in_use(arena, (long)1 << block_order);
+}
+
+//counts a free into a per-CPU stack or cache, see stats_alloc_cached
+/*
+ * @param arena the arena
+ * @param block_order the block order freed
+ */
+static void stats_free_cached(buddy_arena_t *arena, int block_order){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+
+	atomic_fetch_add_explicit(&pcp->frees[block_order - arena->min_order], 1, memory_order_relaxed);
+	stats_in_use(arena, -((long)1 << block_order));
+}
+
+//moves up to PCP_BATCH blocks of the given order from the free area into a per-CPU cache. The cache lock must be held
+/*
+ * @param arena the arena owning the cache
+ * @param pcp the cache to refill
+ * @param block_order the block order to refill
+ */
+static void pcp_refill(buddy_arena_t *arena, buddy_pcp_t *pcp, int block_order){
+	int slot = block_order - arena->pcp_min_order;
+	int starting_block_order;
+
+	pthread_mutex_lock(&arena->lock);
+	while(pcp->count[slot] < PCP_BATCH && (starting_block_order = request_closest_free_block_order(arena, block_order)) != -1){
+		void *mem_addr = _buddy_alloc(arena, starting_block_order, block_order);
+		pcp->pages[slot][pcp->count[slot]++] = ADDR_TO_PAGE(arena, mem_addr);
+	}
+	pthread_mutex_unlock(&arena->lock);
+}
+
+//returns the n oldest blocks of the given order in a per-CPU cache to the free area. The cache lock must be held
+/*
+ * @param arena the arena owning the cache
+ * @param pcp the cache to drain
+ * @param block_order the block order to drain
+ * @param n number of blocks to drain, at most the number of cached blocks
+ */
+static void pcp_drain(buddy_arena_t *arena, buddy_pcp_t *pcp, int block_order, int n){
+	int slot = block_order - arena->pcp_min_order;
+	int i;
+
+	pthread_mutex_lock(&arena->lock);
+	for(i = 0; i < n; i++)
+		_buddy_free(arena, block_order, pcp->pages[slot][i]);
+	pthread_mutex_unlock(&arena->lock);
+
+	pcp->count[slot] -= n;
+	memmove(pcp->pages[slot], pcp->pages[slot] + n, pcp->count[slot] * sizeof(long));
+}
+
+//allocates a block of a cached order from the calling CPU's cache, refilling it from the free area when empty
+/*
+ * @param arena the arena to allocate from
+ * @param block_order the block order to allocate
+ * @return memory block address, or NULL if neither the cache nor the free area has a block to give
+ */
+static void *pcp_alloc(buddy_arena_t *arena, int block_order){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+	int slot = block_order - arena->pcp_min_order;
+	long page_index = -1;
+
+	pthread_mutex_lock(&pcp->lock);
+	if(pcp->count[slot] == 0)
+		pcp_refill(arena, pcp, block_order);
+	if(pcp->count[slot] > 0)
+		page_index = pcp->pages[slot][--pcp->count[slot]];
+	pthread_mutex_unlock(&pcp->lock);
+
+	return page_index == -1 ? NULL : PAGE_TO_ADDR(arena, page_index);
+}
+
+//frees a block of a cached order into the calling CPU's cache, draining the cache to the free area when full
+/*
+ * @param arena the arena owning the block
+ * @param block_order the block order of the block
+ * @param page_index the index of the page heading the block
+ */
+static void pcp_free(buddy_arena_t *arena, int block_order, long page_index){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+	int slot = block_order - arena->pcp_min_order;
+
+	pthread_mutex_lock(&pcp->lock);
+	if(pcp->count[slot] == PCP_HIGH)
+		pcp_drain(arena, pcp, block_order, PCP_BATCH);
+	pcp->pages[slot][pcp->count[slot]++] = page_index;
+	pthread_mutex_unlock(&pcp->lock);
+}
+
+//is the given block order served by the per-CPU caches of the arena?
+static inline bool pcp_order(buddy_arena_t *arena, int block_order){
+	return arena->pcp && block_order >= arena->pcp_min_order && block_order < arena->pcp_min_order + PCP_ORDERS;
+}
+
+//is the given block order served by the lock-free stacks of the arena?
+static inline bool lf_order(buddy_arena_t *arena, int block_order){
+	return arena->lf_next && block_order == arena->min_order;
+}
+
+//pushes a single-page block onto a CPU's lock-free stack. Any thread may push onto any CPU's stack, e.g. after migrating
+/*
+ * @param arena the arena owning the block
+ * @param pcp the CPU's cache holding the stack
+ * @param page_index the index of the page
+ */
+static void lf_push(buddy_arena_t *arena, buddy_pcp_t *pcp, long page_index){
+	uint64_t old_head = atomic_load(&pcp->lf_head);
+	uint64_t new_head;
+
+	do {
+		atomic_store_explicit(&arena->lf_next[page_index], (uint32_t)old_head, memory_order_relaxed);
+		new_head = ((old_head >> 32) + 1) << 32 | (uint64_t)(page_index + 1);	//bumping the tag on every change makes a stale head fail the exchange (ABA)
+	} while(!atomic_compare_exchange_weak(&pcp->lf_head, &old_head, new_head));
+	atomic_fetch_add_explicit(&pcp->lf_count, 1, memory_order_relaxed);
+}
+
+//pops a single-page block off a CPU's lock-free stack
+/*
+ * @param arena the arena
+ * @param pcp the CPU's cache holding the stack
+ * @return the page index of the block, or -1 if the stack is empty
+ */
+static long lf_pop(buddy_arena_t *arena, buddy_pcp_t *pcp){
+	uint64_t old_head = atomic_load(&pcp->lf_head);
+	uint64_t new_head;
+
+	do {
+		if(!(uint32_t)old_head)
+			return -1;
+		//a concurrent pop may hand the block out meanwhile, making this read stale. the tag then no longer matches and we retry
+		new_head = ((old_head >> 32) + 1) << 32 | atomic_load_explicit(&arena->lf_next[(uint32_t)old_head - 1], memory_order_relaxed);
+	} while(!atomic_compare_exchange_weak(&pcp->lf_head, &old_head, new_head));
+	atomic_fetch_sub_explicit(&pcp->lf_count, 1, memory_order_relaxed);
+
+	return (long)(uint32_t)old_head - 1;
+}
+
+//allocates a single page from the calling CPU's lock-free stack, refilling it with a batch from the free area when empty
+/*
+ * @param arena the arena to allocate from
+ * @return memory block address, or NULL if neither the stack nor the free area has a page to give
+ */
+static void *lf_alloc(buddy_arena_t *arena){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+	long page_index = lf_pop(arena, pcp);
+	int starting_block_order;
+	int i;
+
+	if(page_index != -1)
+		return PAGE_TO_ADDR(arena, page_index);
+
+	void *mem_addr = NULL;
+
+	pthread_mutex_lock(&arena->lock);
+	for(i = 0; i < LF_BATCH && (starting_block_order = request_closest_free_block_order(arena, arena->min_order)) != -1; i++){
+		void *page_addr = _buddy_alloc(arena, starting_block_order, arena->min_order);
+		if(!mem_addr)
+			mem_addr = page_addr;	//keep the first page for ourselves
+		else
+			lf_push(arena, pcp, ADDR_TO_PAGE(arena, page_addr));
+	}
+	pthread_mutex_unlock(&arena->lock);
+
+	return mem_addr;
+}
+
+//returns up to n pages from a CPU's lock-free stack to the free area
+/*
+ * @param arena the arena
+ * @param pcp the CPU's cache holding the stack
+ * @param n number of pages to drain
+ */
+static void lf_drain(buddy_arena_t *arena, buddy_pcp_t *pcp, long n){
+	long page_index;
+
+	pthread_mutex_lock(&arena->lock);
+	while(n-- > 0 && (page_index = lf_pop(arena, pcp)) != -1)
+		_buddy_free(arena, arena->min_order, page_index);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+//frees a single page onto the calling CPU's lock-free stack, draining a batch to the free area when over the high watermark
+/*
+ * @param arena the arena owning the page
+ * @param page_index the index of the page
+ */
+static void lf_free(buddy_arena_t *arena, long page_index){
+	buddy_pcp_t *pcp = this_cpu_pcp(arena);
+
+	if(atomic_load_explicit(&pcp->lf_count, memory_order_relaxed) >= LF_HIGH)
+		lf_drain(arena, pcp, LF_BATCH);
+	lf_push(arena, pcp, page_index);
+}
+
+/**
+ * Return all blocks held in per-CPU caches, the lock-free page stacks and lazy caches to the free area
+ *
+ * Only concurrent and lazy arenas cache blocks; for other arenas this does
+ * nothing. Allocation calls this by itself before giving up, so it is only
+ * needed to get an exact picture of the free area, e.g. before
+ * buddy_arena_dump, or to coalesce a lazy arena in the background, e.g. from
+ * a maintenance thread while the arena is idle.
+ *
+ * @param arena the arena to drain
+ */
+void buddy_arena_drain(buddy_arena_t *arena)
+{
+	int i, o;
+
+	for(i = 0; i < arena->num_pcp; i++){
+		buddy_pcp_t *pcp = &arena->pcp[i];
+
+		lf_drain(arena, pcp, arena->num_pages);
+		pthread_mutex_lock(&pcp->lock);
+		for(o = arena->pcp_min_order; pcp_order(arena, o) && o <= arena->max_order; o++)
+			pcp_drain(arena, pcp, o, pcp->count[o - arena->pcp_min_order]);
+		pthread_mutex_unlock(&pcp->lock);
+	}
+
+	if(lazy_arena(arena)){
+		pthread_mutex_lock(&arena->lock);
+		for(o = arena->min_order; o <= arena->max_order; o++)
+			lazy_drain(arena, o, arena->lazy_count[o]);
+		pthread_mutex_unlock(&arena->lock);
+	}
+}
+
+//bytes held in the per-CPU caches and on the lock-free page stacks. Read without their locks, so only a hint
+static size_t cached_bytes(buddy_arena_t *arena){
+	size_t bytes = 0;
+	int i, slot;
+
+	for(i = 0; i < arena->num_pcp; i++){
+		int lf_count = atomic_load_explicit(&arena->pcp[i].lf_count, memory_order_relaxed);
+
+		if(lf_count > 0)	//a pop may have taken its block before the push that put it there counted it
+			bytes += (size_t)lf_count << arena->min_order;
+		for(slot = 0; slot < PCP_ORDERS; slot++)
+			bytes += (size_t)__atomic_load_n(&arena->pcp[i].count[slot], __ATOMIC_RELAXED) << (arena->pcp_min_order + slot);
+	}
+
+	return bytes;
+}
+
+//bytes in the free area. Read without the zone lock, so only a hint
+static size_t free_area_bytes(buddy_arena_t *arena){
+	size_t bytes = 0;
+	int o;
+
+	for(o = arena->min_order; o <= arena->max_order; o++)
+		bytes += (size_t)__atomic_load_n(&arena->nr_free[o], __ATOMIC_RELAXED) << o;
+
+	return bytes;
+}
+
+//takes cached blocks back into the free area after an allocation of size bytes found none large enough
+/*
+ * Draining every CPU's cache takes every cache lock, and near a full arena
+ * that would happen on every failed allocation. So the calling CPU's cache
+ * and lock-free page stack and the lazy caches go first, and the other CPUs'
+ * caches and stacks only when together with the free area they hold enough to serve the
+ * request at all.
+ *
+ * @param arena the arena
+ * @param size bytes the failed allocation needs
+ * @return false if the arena caches nothing, so retrying is pointless
+ */
+static bool arena_drain_for(buddy_arena_t *arena, size_t size){
+	int o;
+
+	if(!arena_caches(arena))
+		return false;
+
+	if(arena->pcp){
+		buddy_pcp_t *pcp = this_cpu_pcp(arena);
+
+		lf_drain(arena, pcp, arena->num_pages);
+		pthread_mutex_lock(&pcp->lock);
+		for(o = arena->pcp_min_order; pcp_order(arena, o) && o <= arena->max_order; o++)
+			pcp_drain(arena, pcp, o, pcp->count[o - arena->pcp_min_order]);
+		pthread_mutex_unlock(&pcp->lock);
+
+		size_t remote = cached_bytes(arena);
+		if(remote && remote + free_area_bytes(arena) >= size)
+			buddy_arena_drain(arena);
+	}
+
+	if(lazy_arena(arena)){
+		pthread_mutex_lock(&arena->lock);
+		for(o = arena->min_order; o <= arena->max_order; o++)
+			lazy_drain(arena, o, arena->lazy_count[o]);
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	return true;
+}
+
+//asks the reclaim callback to make room for size bytes after an allocation failed, see buddy_arena_set_reclaim
+/*
+ * What the callback frees may land in the per-CPU or lazy caches, where only
+ * the allocation paths that go through them would find it, so those are
+ * drained again afterwards.
+ *
+ * @param arena the arena
+ * @param size bytes the failed allocation needs
+ * @return true if the callback made room, so retrying may succeed
+ */
+static bool arena_reclaim(buddy_arena_t *arena, size_t size){
+	if(!arena->reclaim || !arena->reclaim(arena, size, arena->reclaim_ctx))
+		return false;
+	arena_drain_for(arena, size);
+	return true;
+}
+
+/**
+ * Allocate a memory block from an arena.
+ *
+ * On a memory request, the allocator returns the head of a free-list of the
+ * matching size (i.e., smallest block that satisfies the request). If the
+ * free-list of the matching block size is empty, then a larger block size will
+ * be selected. The selected (large) block is then splitted into two smaller
+ * blocks. Among the two blocks, left block will be used for allocation or be
+ * further splitted while the right block will be added to the appropriate
+ * free-list.
+ *
+ * If no block is large enough, the arena's reclaim callback, if any, is given
+ * a chance to make room before the allocation fails.
+ *
+ * Safe to call from several threads at once.
+ *
+ * @param arena the arena to allocate from
+ * @param size size in bytes
+ * @return memory block address
+ */
+void *buddy_arena_alloc(buddy_arena_t *arena, size_t size)
+{
+
+	#if TESTING
+		printf("REQUESTED: %.2fKB\n", (float)size/1024);
+	#endif
+
+	//requests larger than the largest block can never be served. rejecting them here also keeps the order math from overflowing
+	if(size > ((size_t)1 << arena->max_order)){
+		stats_failed(arena, 1);
+		return NULL;
+	}
+
+	int target_block_order = size_to_block_order(arena, size); //the (starting) free block order to search a free spot in
+
+	#if TESTING
+		size_t alloc_bytes = (size_t)1 << target_block_order;
+	#endif
+
+	void *mem_addr_allocd = NULL;
+
+	if(lf_order(arena, target_block_order) || pcp_order(arena, target_block_order)){
+		mem_addr_allocd = lf_order(arena, target_block_order) ? lf_alloc(arena) : pcp_alloc(arena, target_block_order);
+		if(mem_addr_allocd)
+			stats_alloc_cached(arena, target_block_order, size);
+	}
+	else
+		mem_addr_allocd = arena_alloc_order(arena, target_block_order, size);
+
+	//blocks parked in per-CPU or lazy caches may be what is missing to serve the request
+	if(!mem_addr_allocd && arena_drain_for(arena, (size_t)1 << target_block_order))
+		mem_addr_allocd = arena_alloc_order(arena, target_block_order, size);
+
+	//last resort: let the owner of the arena make room, e.g. by compacting (see buddy_arena_set_reclaim)
+	if(!mem_addr_allocd && arena_reclaim(arena, size))
+		mem_addr_allocd = arena_alloc_order(arena, target_block_order, size);
+
+	if(!mem_addr_allocd)
+		stats_failed(arena, 1);
+
+	#if TESTING
+		printf("ALLOCATED: %zuKB\n", (mem_addr_allocd ? alloc_bytes : 0)/1024 );
+	#endif
+
+	return mem_addr_allocd;
+}
+
+//number of pages of an exact allocation, under the zone lock
+/*
+ * The allocation is made of blocks of decreasing order, one per bit set in
+ * its extent, laid out from its first page up. Every block but the last is
+ * marked exact_more.
+ *
+ * @param arena the arena owning the allocation
+ * @param page_index the index of the first page of the allocation
+ * @return the number of pages, or 0 if the block is not an exact allocation
+ */
+static long exact_extent(buddy_arena_t *arena, long page_index){
+	long extent = 0;
+	bool more;
+
+	if(!arena->pages[page_index].exact_more)
+		return 0;
+	do {
+		more = arena->pages[page_index].exact_more;
+		extent += BUDDY_OFFSET(arena, arena->pages[page_index].block_order);
+		page_index += BUDDY_OFFSET(arena, arena->pages[page_index].block_order);
+	} while(more);
+
+	return extent;
+}
+
+//frees an exact allocation piece by piece, under the zone lock
+/*
+ * @param arena the arena owning the allocation
+ * @param page_index the index of the first page of the allocation
+ */
+static void _buddy_free_exact(buddy_arena_t *arena, long page_index){
+	long extent = 0;
+	bool more;
+
+	do {
+		int block_order = arena->pages[page_index].block_order;
+
+		more = arena->pages[page_index].exact_more;
+		arena->pages[page_index].exact_more = false;
+		_buddy_free(arena, block_order, page_index);
+		page_index += BUDDY_OFFSET(arena, block_order);
+		extent += BUDDY_OFFSET(arena, block_order);
+	} while(more);
+
+	stats_free(arena, LOG2_CEIL(extent) + arena->min_order, (size_t)extent << arena->min_order);	//counted at the order of the covering block
+}
+
+/**
+ * Allocate exactly as many pages as a request needs from an arena.
+ *
+ * The covering power-of-two block is allocated as usual, then the pages past
+ * the request are returned to the free area at once as smaller buddies. The
+ * pages kept are recorded as one allocation spanning several blocks, so
+ * buddy_arena_free releases all of them and they coalesce as usual. This
+ * roughly halves the memory wasted on sizes that are not a power of two (an
+ * 80K request takes 80K rather than 128K). Like buddy_arena_alloc, it gives
+ * the reclaim callback a chance to make room before failing.
+ *
+ * @param arena the arena to allocate from
+ * @param size size in bytes
+ * @return memory block address, page aligned but not naturally aligned to its size
+ */
+void *buddy_arena_alloc_exact(buddy_arena_t *arena, size_t size)
+{
+	if(size > ((size_t)1 << arena->max_order)){
+		stats_failed(arena, 1);
+		return NULL;
+	}
+
+	int target_block_order = size_to_block_order(arena, size);
+	long extent = (long)((size + ARENA_PAGE_SIZE(arena) - 1) >> arena->min_order);	//pages actually needed
+	long block_pages = BUDDY_OFFSET(arena, target_block_order);
+
+	if(extent <= 1 || extent == block_pages)	//nothing to trim
+		return buddy_arena_alloc(arena, size);
+
+	void *mem_addr = arena_alloc_order(arena, target_block_order, 0);
+
+	if(!mem_addr && arena_drain_for(arena, (size_t)1 << target_block_order))
+		mem_addr = arena_alloc_order(arena, target_block_order, 0);
+	if(!mem_addr && arena_reclaim(arena, size))
+		mem_addr = arena_alloc_order(arena, target_block_order, 0);
+	if(!mem_addr){
+		stats_failed(arena, 1);
+		return NULL;
+	}
+
+	long page_index = ADDR_TO_PAGE(arena, mem_addr);
+	long piece_index = page_index, last_index = page_index;
+	int o;
+
+	pthread_mutex_lock(&arena->lock);
+
+	//keep one block per bit set in the extent, largest first, each linked to the next
+	for(o = target_block_order - 1; o >= arena->min_order; o--){
+		if(extent & BUDDY_OFFSET(arena, o)){
+			arena->pages[piece_index].block_order = o;
+			arena->pages[piece_index].exact_more = true;
+			last_index = piece_index;
+			piece_index += BUDDY_OFFSET(arena, o);
+		}
+	}
+	arena->pages[last_index].exact_more = false;
+
+	free_area_add_range(arena, page_index + extent, page_index + block_pages);	//trim the tail
+	stats_alloc(arena, target_block_order, size, (size_t)extent << arena->min_order);
+
+	pthread_mutex_unlock(&arena->lock);
+
+	return mem_addr;
+}
+
+/**
+ * Allocate exactly as many pages as a request needs from the default arena.
+ *
+ * @param size size in bytes
+ * @return memory block address
+ */
+void *buddy_alloc_exact(size_t size)
+{
+	return buddy_arena_alloc_exact(&g_arena, size);
+}
+
+/**
+ * Allocate a memory block aligned to a power of two from an arena.
+ *
+ * The block has the smallest order that holds size bytes, no matter how large
+ * the alignment. It is carved from the start of a free block of at least the
+ * alignment's order, which is aligned since blocks are naturally aligned
+ * relative to the arena base. The alignment is absolute only as far as the
+ * base itself is aligned, so requests for more than that fail.
+ *
+ * @param arena the arena to allocate from
+ * @param size size in bytes
+ * @param align alignment in bytes, a power of two
+ * @return memory block address, or NULL if out of memory or the alignment cannot be met
+ */
+void *buddy_arena_alloc_aligned(buddy_arena_t *arena, size_t size, size_t align)
+{
+	if(align == 0 || (align & (align - 1)) || size > ((size_t)1 << arena->max_order) || align > ((size_t)1 << arena->max_order)){
+		stats_failed(arena, 1);
+		return NULL;
+	}
+
+	int target_block_order = size_to_block_order(arena, size);
+	int align_order = LOG2_FLOOR(align);
+
+	if(align_order > __builtin_ctzl((unsigned long)arena->base)){	//the base is not aligned enough, so no block is
+		stats_failed(arena, 1);
+		return NULL;
+	}
+
+	if(align_order <= target_block_order)	//blocks are aligned to their own size already
+		return buddy_arena_alloc(arena, size);
+
+	void *mem_addr = arena_alloc_order_from(arena, target_block_order, align_order, size);
+
+	if(!mem_addr && arena_drain_for(arena, (size_t)1 << align_order))
+		mem_addr = arena_alloc_order_from(arena, target_block_order, align_order, size);
+	if(!mem_addr)
+		stats_failed(arena, 1);
+
+	return mem_addr;
+}
+
+/**
+ * Allocate a memory block aligned to a power of two from the default arena.
+ *
+ * The default arena is aligned to its size, so any alignment up to 1MB works.
+ *
+ * @param size size in bytes
+ * @param align alignment in bytes, a power of two
+ * @return memory block address
+ */
+void *buddy_alloc_aligned(size_t size, size_t align)
+{
+	return buddy_arena_alloc_aligned(&g_arena, size, align);
+}
+
+/**
+ * Allocate a memory block from the default arena.
+ *
+ * @param size size in bytes
+ * @return memory block address
+ */
+void *buddy_alloc(size_t size)
+{
+	return buddy_arena_alloc(&g_arena, size);
+}
+
+//iteratively frees block orders upwards, as long as the buddy of the freeable page index is also free. If not, it will stop, and no longer iterate.
+/*
+ * @param arena the arena owning the page
+ * @param block_order the block order than contains the freeable page
+ * @return page_index the index of the freeable page
+ */
+void _buddy_free(buddy_arena_t *arena, int block_order, long page_index){
+
+	long buddy_page_index;
+	long freed_page_index = page_index;	//the block this free gives back, before coalescing
+	int freed_order = block_order;
+
+	arena->pages[page_index].block_order = -1;	//the page is no longer allocated. it will head a block again once it is added to the free area
+
+	//if the buddy is free, remove it and redo at the next block level. the buddy is free only if it heads a free block of this very order
+	while(block_order < arena->max_order){
+		buddy_page_index = page_index + (CHECK_IF_BUDDY(arena, page_index, block_order) ? -BUDDY_OFFSET(arena, block_order) : BUDDY_OFFSET(arena, block_order)); //get the page index of the buddy based on this page's index
+		if(buddy_page_index >= arena->num_pages)	//blocks in the tail of an arena that is not a whole number of max order blocks may have no buddy
+			break;
+		if(!arena->pages[buddy_page_index].is_free || arena->pages[buddy_page_index].block_order != block_order)
+			break;
+		#if TESTING
+			printf("	freeing buddy %p at block order %d, at page index %ld, which is the buddy of page index %ld\n", PAGE_TO_ADDR(arena, buddy_page_index), block_order, buddy_page_index, page_index);
+		#endif
+		free_area_del(arena, buddy_page_index); 	//delete this page's buddy
+		stats_inc_locked(&arena->stats.merges[block_order]);
+		page_index = (buddy_page_index < page_index ? buddy_page_index : page_index); //set the appropriate page index in the next block order (up). used in the next iteration.
+		block_order++;
+	}
+
+	//once no more buddies remain, add the freed block to the free area
+	free_area_add(arena, page_index, block_order); //free this page
+
+	//large free blocks give their memory back to the kernel. this has to happen under the zone lock, before the block can be handed out again.
+	//the buddies merged above the release order were released when they became free (here or in free_area_release), so only the release order block around the freed one is new
+	if(block_order >= arena->release_order){
+		int release_order = freed_order > arena->release_order ? freed_order : arena->release_order;
+		long release_page_index = freed_page_index & ~(BUDDY_OFFSET(arena, release_order) - 1);
+
+		madvise(PAGE_TO_ADDR(arena, release_page_index), (size_t)1 << release_order, MADV_DONTNEED);
+	}
+
+}
+
+/**
+ * Free an allocated memory block back to its arena.
+ *
+ * Whenever a block is freed, the allocator checks its buddy. If the buddy is
+ * free as well, then the two buddies are combined to form a bigger block. This
+ * process continues until one of the buddies is not free.
+ *
+ * Safe to call from several threads at once.
+ *
+ * @param arena the arena the block was allocated from
+ * @param addr memory block address to be freed. NULL is ignored
+ */
+void buddy_arena_free(buddy_arena_t *arena, void *addr)
+{
+	if(!addr)
+		return;
+
+	long page_index = ADDR_TO_PAGE(arena, addr);	//page index of the freeable address
+
+	#if TESTING
+
+		if( (char *)addr < arena->base || page_index >= arena->num_pages ){
+			fprintf(stderr, "Error: Attempted to free an OUT-OF-BOUNDS Address (%p). The valid address range is from %p to %p.\n", (int*)addr, arena->base, arena->base + arena->size - 1);
+			exit(EXIT_FAILURE);
+		}
+
+		if(arena->pages[page_index].block_order == -1){
+			fprintf(stderr, "Error: Attempted to free an address that was never allocated (%p).\n", (int*)addr);
+			exit(EXIT_FAILURE);
+		}
+
+		printf("FREEING addr %p\n",  (int*)addr);
+		/* Make sure we're not double freeing. For Testing Purposes (Although, probably a good thing to have in general, just like the real free() function does) */
+		if(arena->pages[page_index].is_free || arena->pages[page_index].is_lazy){
+			fprintf(stderr, "Error: Attempted a double free at addr %p, block order %d, page index %ld\n", (int*)addr, arena->pages[page_index].block_order, page_index);
+			exit(EXIT_FAILURE);
+		}
+
+	#endif
+
+		int block_order = arena->pages[page_index].block_order;	//block order of the freeable page
+
+		if(arena->pages[page_index].exact_more){
+			pthread_mutex_lock(&arena->lock);
+			_buddy_free_exact(arena, page_index);
+			pthread_mutex_unlock(&arena->lock);
+			return;
+		}
+		if(lf_order(arena, block_order)){
+			stats_free_cached(arena, block_order);
+			lf_free(arena, page_index);
+			return;
+		}
+		if(pcp_order(arena, block_order)){
+			stats_free_cached(arena, block_order);
+			pcp_free(arena, block_order, page_index);
+			return;
+		}
+
+		//free the page and buddies iteratively, unless a lazy arena parks the block for reuse
+		pthread_mutex_lock(&arena->lock);
+		stats_free(arena, block_order, (size_t)1 << block_order);
+		if(lazy_arena(arena))
+			lazy_free(arena, block_order, page_index);
+		else
+			_buddy_free(arena, block_order, page_index);
+		pthread_mutex_unlock(&arena->lock);
+
+}
+
+/**
+ * Free an allocated memory block back to the default arena.
+ *
+ * @param addr memory block address to be freed
+ */
+void buddy_free(void *addr)
+{
+	buddy_arena_free(&g_arena, addr);
+}
+
+//tries to resize an allocated block without moving it, under the zone lock
+/*
+ * Shrinking splits the block and returns its tail halves to the free area.
+ * Growing absorbs the right-hand buddy at each order up to the target order,
+ * which is only possible if the block is the left buddy at every one of these
+ * orders and each right-hand buddy is a free block of exactly that order.
+ *
+ * @param arena the arena owning the block
+ * @param page_index the index of the page heading the block
+ * @param target_block_order the block order wanted
+ * @return true if the block now has the target order
+ */
+static bool resize_in_place(buddy_arena_t *arena, long page_index, int target_block_order){
+	int block_order = arena->pages[page_index].block_order;
+	int o;
+
+	if(target_block_order < block_order){
+		for(o = block_order - 1; o >= target_block_order; o--)
+			free_area_release(arena, page_index + BUDDY_OFFSET(arena, o), o);
+		arena->pages[page_index].block_order = target_block_order;
+		return true;
+	}
+
+	//check every order first, so nothing is touched unless the whole growth succeeds
+	for(o = block_order; o < target_block_order; o++){
+		long buddy_page_index = page_index + BUDDY_OFFSET(arena, o);
+
+		if(CHECK_IF_BUDDY(arena, page_index, o) || buddy_page_index >= arena->num_pages)
+			return false;
+		if(!arena->pages[buddy_page_index].is_free || arena->pages[buddy_page_index].block_order != o)
+			return false;
+	}
+
+	for(o = block_order; o < target_block_order; o++)
+		free_area_del(arena, page_index + BUDDY_OFFSET(arena, o));
+	arena->pages[page_index].block_order = target_block_order;
+
+	return true;
+}
+
+/**
+ * Resize an allocated block of an arena.
+ *
+ * The block is resized in place whenever possible: it shrinks by splitting
+ * off its tail halves, and grows by merging with its right-hand buddies if
+ * they are free (see BUDDY_ADDR). Only if that fails is a new block allocated
+ * and the contents copied over.
+ *
+ * @param arena the arena the block was allocated from
+ * @param addr memory block address. NULL makes this an allocation
+ * @param size new size in bytes. 0 frees the block
+ * @return the address of the resized block, which may differ from addr. NULL
+ * if out of memory, in which case the original block is left untouched
+ */
+void *buddy_arena_realloc(buddy_arena_t *arena, void *addr, size_t size)
+{
+	if(!addr)
+		return buddy_arena_alloc(arena, size);
+
+	if(size == 0){
+		buddy_arena_free(arena, addr);
+		return NULL;
+	}
+
+	if(size > ((size_t)1 << arena->max_order))
+		return NULL;
+
+	long page_index = ADDR_TO_PAGE(arena, addr);
+	int target_block_order = size_to_block_order(arena, size);
+	bool resized = false;
+	size_t old_size;
+
+	pthread_mutex_lock(&arena->lock);
+	int block_order = arena->pages[page_index].block_order;
+	long extent = exact_extent(arena, page_index);
+	if(!extent)	//exact allocations span several blocks, so they are always moved
+		resized = target_block_order == block_order || resize_in_place(arena, page_index, target_block_order);
+	if(resized)
+		stats_in_use(arena, (long)((size_t)1 << target_block_order) - (long)((size_t)1 << block_order));
+	pthread_mutex_unlock(&arena->lock);
+
+	if(resized)
+		return addr;
+
+	//last resort: move the contents to a new block
+	void *new_addr = buddy_arena_alloc(arena, size);
+
+	if(new_addr){
+		old_size = extent ? (size_t)extent << arena->min_order : (size_t)1 << block_order;
+		memcpy(new_addr, addr, old_size < size ? old_size : size);
+		buddy_arena_free(arena, addr);
+	}
+
+	return new_addr;
+}
+
+/**
+ * Move an allocated block to the lowest free spot below it.
+ *
+ * The free block taken is the lowest one below the block, out of the smallest
+ * order that has one, so larger free blocks are only split when no block of
+ * the same order is free lower down. The contents are copied and the old block
+ * is freed straight to the free area, where it may coalesce. Moving every
+ * movable block down, highest first, compacts the arena and re-forms large
+ * free blocks at its top.
+ *
+ * The caller must make sure nothing else uses the block while it moves.
+ * Exact allocations are never moved.
+ *
+ * @param arena the arena owning the block
+ * @param addr memory block address
+ * @return the new address of the block, or addr if it did not move
+ */
+void *buddy_arena_move_down(buddy_arena_t *arena, void *addr)
+{
+	long page_index = ADDR_TO_PAGE(arena, addr);
+	long target_page_index = -1;
+	void *new_addr;
+	int block_order, o;
+
+	pthread_mutex_lock(&arena->lock);
+	block_order = arena->pages[page_index].block_order;
+	if(!arena->pages[page_index].exact_more){	//exact allocations span several blocks, so they stay put
+		for(o = block_order; o <= arena->max_order && target_page_index == -1; o++){
+			long lowest = free_area_lowest(arena, o);
+			if(lowest != -1 && lowest < page_index)
+				target_page_index = lowest;
+		}
+	}
+	if(target_page_index == -1){
+		pthread_mutex_unlock(&arena->lock);
+		return addr;
+	}
+	new_addr = split_free_block(arena, target_page_index, block_order);
+	pthread_mutex_unlock(&arena->lock);
+
+	memcpy(new_addr, addr, (size_t)1 << block_order);
+
+	pthread_mutex_lock(&arena->lock);
+	_buddy_free(arena, block_order, page_index);
+	pthread_mutex_unlock(&arena->lock);
+
+	return new_addr;
+}
+
+//carves blocks of one order out of the free area for buddy_arena_alloc_bulk, under the zone lock
+/*
+ * @param arena the arena to allocate from
+ * @param target_block_order the block order to hand out
+ * @param size bytes asked for per block
+ * @param count number of blocks wanted in total
+ * @param addrs receives the addresses of the allocated blocks
+ * @param allocd number of blocks already in addrs
+ * @return number of blocks in addrs now
+ */
+static int bulk_fill(buddy_arena_t *arena, int target_block_order, size_t size, int count, void **addrs, int allocd){
+	long step = BUDDY_OFFSET(arena, target_block_order);	//pages per allocated block
+	int first = allocd;
+
+	pthread_mutex_lock(&arena->lock);
+	while(allocd < count){
+		int starting_block_order = request_closest_free_block_order(arena, target_block_order);
+		if(starting_block_order == -1)
+			break;
+
+		long page_index = free_area_pick(arena, starting_block_order);
+		long end_page = page_index + BUDDY_OFFSET(arena, starting_block_order);
+
+		free_area_del(arena, page_index);
+		for(; page_index < end_page && allocd < count; page_index += step){
+			arena->pages[page_index].block_order = target_block_order;
+			addrs[allocd++] = PAGE_TO_ADDR(arena, page_index);
+		}
+		free_area_add_range(arena, page_index, end_page);	//give back what is left of the split block
+	}
+	stats_add(arena, &arena->stats.allocs[target_block_order], allocd - first);
+	stats_add(arena, &arena->stats.bytes_requested, (allocd - first) * size);
+	stats_add(arena, &arena->stats.bytes_granted, (size_t)(allocd - first) << target_block_order);
+	stats_in_use(arena, (long)(allocd - first) << target_block_order);
+	pthread_mutex_unlock(&arena->lock);
+
+	return allocd;
+}
+
+/**
+ * Allocate several blocks of the same size from an arena in a single pass.
+ *
+ * Rather than searching and splitting once per block, each free block taken
+ * from the free area is split down to the requested order once and handed out
+ * as many blocks; only the unused tail goes back to the free area. The
+ * per-CPU caches of concurrent arenas are bypassed, but when the free area
+ * runs short, cached blocks are drained and the reclaim callback is asked to
+ * make room before giving up, as buddy_arena_alloc does.
+ *
+ * @param arena the arena to allocate from
+ * @param size size in bytes of every block
+ * @param count number of blocks wanted
+ * @param addrs receives the addresses of the allocated blocks, in ascending order per split block
+ * @return number of blocks allocated. Less than count if the arena ran out of memory
+ */
+int buddy_arena_alloc_bulk(buddy_arena_t *arena, size_t size, int count, void **addrs)
+{
+	int allocd = 0;
+
+	if(size > ((size_t)1 << arena->max_order)){
+		stats_failed(arena, count);
+		return 0;
+	}
+
+	int target_block_order = size_to_block_order(arena, size);
+
+	allocd = bulk_fill(arena, target_block_order, size, count, addrs, 0);
+
+	//blocks parked in per-CPU or lazy caches may be what is missing
+	if(allocd < count && arena_drain_for(arena, (size_t)(count - allocd) << target_block_order))
+		allocd = bulk_fill(arena, target_block_order, size, count, addrs, allocd);
+
+	//last resort: let the owner of the arena make room for the rest
+	if(allocd < count && arena_reclaim(arena, (count - allocd) * size))
+		allocd = bulk_fill(arena, target_block_order, size, count, addrs, allocd);
+
+	if(allocd < count)
+		stats_failed(arena, count - allocd);
+
+	return allocd;
+}
+
+//a block being freed by buddy_arena_free_bulk
+typedef struct {
+	long page_index;
+	int block_order;
+} bulk_block_t;
+
+//orders bulk_block_t by address
+static int bulk_block_cmp(const void *a, const void *b){
+	long x = ((const bulk_block_t *)a)->page_index, y = ((const bulk_block_t *)b)->page_index;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Free several blocks of an arena in a single pass.
+ *
+ * The blocks are sorted by address first, so buddies that are both being
+ * freed are merged with each other before touching the free area, and the
+ * coalesce loop only runs once per resulting block.
+ *
+ * @param arena the arena the blocks were allocated from
+ * @param addrs addresses of the blocks to free. NULL entries are ignored
+ * @param count number of entries in addrs
+ */
+void buddy_arena_free_bulk(buddy_arena_t *arena, void **addrs, int count)
+{
+	bulk_block_t *blocks;
+	int n = 0, top = 0;
+	int i;
+
+	if(!(blocks = malloc(count * sizeof(*blocks)))){	//out of memory: free the blocks one by one
+		for(i = 0; i < count; i++)
+			buddy_arena_free(arena, addrs[i]);
+		return;
+	}
+
+	pthread_mutex_lock(&arena->lock);
+
+	for(i = 0; i < count; i++){
+		if(!addrs[i])
+			continue;
+		blocks[n].page_index = ADDR_TO_PAGE(arena, addrs[i]);
+		if(arena->pages[blocks[n].page_index].exact_more){	//exact allocations span several blocks, free them on their own
+			_buddy_free_exact(arena, blocks[n].page_index);
+			continue;
+		}
+		blocks[n].block_order = arena->pages[blocks[n].page_index].block_order;
+		stats_free(arena, blocks[n].block_order, (size_t)1 << blocks[n].block_order);
+		n++;
+	}
+	qsort(blocks, n, sizeof(*blocks), bulk_block_cmp);
+
+	//merge adjacent buddies, stack style: blocks[0..top) holds the merged blocks so far
+	for(i = 0; i < n; i++){
+		blocks[top++] = blocks[i];
+		while(top >= 2){
+			bulk_block_t *left = &blocks[top-2], *right = &blocks[top-1];
+
+			if(left->block_order != right->block_order || left->block_order >= arena->max_order
+			   || CHECK_IF_BUDDY(arena, left->page_index, left->block_order)
+			   || left->page_index + BUDDY_OFFSET(arena, left->block_order) != right->page_index)
+				break;
+			arena->pages[right->page_index].block_order = -1;	//the right buddy no longer heads a block
+			stats_inc_locked(&arena->stats.merges[left->block_order]);
+			left->block_order++;
+			top--;
+		}
+	}
+
+	for(i = 0; i < top; i++)
+		_buddy_free(arena, blocks[i].block_order, blocks[i].page_index);
+
+	pthread_mutex_unlock(&arena->lock);
+	free(blocks);
+}
+
+/**
+ * Print the buddy system status of an arena---order oriented
+ *
+ * print free pages in each order. Blocks held in the per-CPU caches of a
+ * concurrent arena are not part of the free area and are not printed. The
+ * counts are kept up to date as blocks enter and leave the free lists, so this
+ * takes time in the number of orders, not in the number of free blocks.
+ *
+ * @param arena the arena to print
+ */
+void buddy_arena_dump(buddy_arena_t *arena)
+{
+	long counts[BUDDY_ORDER_LIMIT+1];
+	int o;
+
+	pthread_mutex_lock(&arena->lock);
+	count_free_blocks(arena, counts);
+	pthread_mutex_unlock(&arena->lock);
+
+	for (o = arena->min_order; o <= arena->max_order; o++) {
+		if (o < 10)
+			printf("%ld:%dB ", counts[o], 1<<o);
+		else
+			printf("%ld:%zuK ", counts[o], ((size_t)1<<o)/1024);
+	}
+	printf("\n");
+}
+
+/**
+ * Print the buddy system status of an arena as a single line of JSON
+ *
+ * Holds the same free block counts as buddy_arena_dump, one object per block
+ * order from smallest to largest, e.g.
+ * {"free":[{"order":12,"size":4096,"count":0},...]}
+ *
+ * @param arena the arena to print
+ */
+void buddy_arena_dump_json(buddy_arena_t *arena)
+{
+	long counts[BUDDY_ORDER_LIMIT+1];
+	int o;
+
+	pthread_mutex_lock(&arena->lock);
+	count_free_blocks(arena, counts);
+	pthread_mutex_unlock(&arena->lock);
+
+	printf("{\"free\":[");
+	for (o = arena->min_order; o <= arena->max_order; o++)
+		printf("%s{\"order\":%d,\"size\":%zu,\"count\":%ld}", o > arena->min_order ? "," : "", o, (size_t)1 << o, counts[o]);
+	printf("]}\n");
+}
+
+/**
+ * Resize an allocated block of the default arena.
+ *
+ * @param addr memory block address. NULL makes this an allocation
+ * @param size new size in bytes. 0 frees the block
+ * @return the address of the resized block, or NULL if out of memory
+ */
+void *buddy_realloc(void *addr, size_t size)
+{
+	return buddy_arena_realloc(&g_arena, addr, size);
+}
+
+/**
+ * Allocate several blocks of the same size from the default arena.
+ *
+ * @param size size in bytes of every block
+ * @param count number of blocks wanted
+ * @param addrs receives the addresses of the allocated blocks
+ * @return number of blocks allocated
+ */
+int buddy_alloc_bulk(size_t size, int count, void **addrs)
+{
+	return buddy_arena_alloc_bulk(&g_arena, size, count, addrs);
+}
+
+/**
+ * Free several blocks of the default arena.
+ *
+ * @param addrs addresses of the blocks to free. NULL entries are ignored
+ * @param count number of entries in addrs
+ */
+void buddy_free_bulk(void **addrs, int count)
+{
+	buddy_arena_free_bulk(&g_arena, addrs, count);
+}
+
+/**
+ * Take a snapshot of the allocation statistics of the default arena
+ *
+ * @param stats receives the snapshot
+ */
+void buddy_stats(buddy_stats_t *stats)
+{
+	buddy_arena_stats(&g_arena, stats);
+}
+
+/**
+ * Print the buddy system status of the default arena
+ */
+void buddy_dump()
+{
+	buddy_arena_dump(&g_arena);
+}
+
+/**
+ * Print the buddy system status of the default arena as JSON
+ */
+void buddy_dump_json()
+{
+	buddy_arena_dump_json(&g_arena);
 }
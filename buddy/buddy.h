@@ -1,9 +1,88 @@
 #ifndef BUDDY_H
 #define BUDDY_H
 
+#include <stddef.h>
+
+/* largest block order an arena may be configured with */
+#define BUDDY_ORDER_LIMIT 48
+
+/* block order of a transparent huge page (2MB) */
+#define BUDDY_HUGE_PAGE_ORDER 21
+
+/* flags for buddy_arena_create_flags and buddy_arena_create_mmap */
+#define BUDDY_ARENA_CONCURRENT 0x1	/* serve single pages from per-CPU lock-free stacks and other small blocks from per-CPU caches in front of the shared free lists */
+#define BUDDY_ARENA_HUGEPAGE 0x2	/* buddy_arena_create_mmap only: back the arena with transparent huge pages */
+#define BUDDY_ARENA_LAZY 0x4		/* keep freed blocks uncoalesced in per-order caches, coalescing only past a watermark or under memory pressure */
+
+/* which free block of an order an arena hands out, see buddy_arena_set_placement */
+typedef enum buddy_placement_t {
+	BUDDY_PLACEMENT_FIFO = 0,	/* the block freed longest ago (the default) */
+	BUDDY_PLACEMENT_LIFO,		/* the block freed last, most likely still in cache */
+	BUDDY_PLACEMENT_ADDRESS,	/* the block at the lowest address, so low memory is reused first */
+	BUDDY_PLACEMENT_BUDDY_BUSY	/* a block whose buddy is split, sparing blocks one free away from coalescing */
+} buddy_placement_t;
+
+/* snapshot of the allocation statistics of an arena, see buddy_arena_stats */
+typedef struct buddy_stats_t {
+	int min_order;					/* orders below min_order and above max_order are always 0 */
+	int max_order;
+	unsigned long allocs[BUDDY_ORDER_LIMIT+1];	/* blocks handed out, per block order */
+	unsigned long frees[BUDDY_ORDER_LIMIT+1];	/* blocks freed, per block order */
+	unsigned long splits[BUDDY_ORDER_LIMIT+1];	/* free blocks of each order split into two buddies */
+	unsigned long merges[BUDDY_ORDER_LIMIT+1];	/* pairs of free buddies of each order merged */
+	long free_blocks[BUDDY_ORDER_LIMIT+1];		/* blocks on the free list of each order right now */
+	unsigned long failed;				/* allocations that returned NULL */
+	size_t bytes_requested;				/* bytes asked for, over all allocations */
+	size_t bytes_granted;				/* bytes handed out for them. The difference is internal fragmentation */
+	size_t in_use;					/* bytes currently allocated */
+	size_t peak_in_use;				/* most bytes ever allocated at once */
+	int largest_free_order;				/* order of the largest free block, -1 if none */
+} buddy_stats_t;
+
+/* an independent buddy system over a caller-provided memory region */
+typedef struct buddy_arena buddy_arena_t;
+
+/* called when an arena cannot serve an allocation of size bytes. Returns nonzero if it made room, see buddy_arena_set_reclaim */
+typedef int (*buddy_reclaim_fn)(buddy_arena_t *arena, size_t size, void *ctx);
+
 void buddy_init();
-void *buddy_alloc(int size);
+void *buddy_alloc(size_t size);
+void *buddy_alloc_exact(size_t size);
+void *buddy_alloc_aligned(size_t size, size_t align);
 void buddy_free(void *addr);
+void *buddy_realloc(void *addr, size_t size);
 void buddy_dump();
+void buddy_dump_json();
+int buddy_alloc_bulk(size_t size, int count, void **addrs);
+void buddy_free_bulk(void **addrs, int count);
+void buddy_stats(buddy_stats_t *stats);
+
+buddy_arena_t *buddy_arena_create(void *base, size_t size, int min_order, int max_order);
+buddy_arena_t *buddy_arena_create_flags(void *base, size_t size, int min_order, int max_order, unsigned flags);
+buddy_arena_t *buddy_arena_create_mmap(size_t size, int min_order, int max_order, unsigned flags);
+void buddy_arena_set_release_order(buddy_arena_t *arena, int order);
+long buddy_arena_intact_blocks(buddy_arena_t *arena, int order);
+void buddy_arena_set_placement(buddy_arena_t *arena, buddy_placement_t placement);
+double buddy_arena_fragmentation(buddy_arena_t *arena);
+void buddy_arena_stats(buddy_arena_t *arena, buddy_stats_t *stats);
+void buddy_arena_set_reclaim(buddy_arena_t *arena, buddy_reclaim_fn reclaim, void *ctx);
+void buddy_arena_get_reclaim(buddy_arena_t *arena, buddy_reclaim_fn *reclaim, void **ctx);
+void buddy_arena_destroy(buddy_arena_t *arena);
+buddy_arena_t *buddy_default_arena();
+void *buddy_arena_base(buddy_arena_t *arena);
+size_t buddy_arena_size(buddy_arena_t *arena);
+size_t buddy_arena_page_size(buddy_arena_t *arena);
+void *buddy_arena_page_start(buddy_arena_t *arena, const void *addr);
+void *buddy_arena_alloc(buddy_arena_t *arena, size_t size);
+void *buddy_arena_alloc_exact(buddy_arena_t *arena, size_t size);
+void *buddy_arena_alloc_aligned(buddy_arena_t *arena, size_t size, size_t align);
+void buddy_arena_free(buddy_arena_t *arena, void *addr);
+void *buddy_arena_realloc(buddy_arena_t *arena, void *addr, size_t size);
+void *buddy_arena_move_down(buddy_arena_t *arena, void *addr);
+void buddy_arena_dump(buddy_arena_t *arena);
+void buddy_arena_dump_json(buddy_arena_t *arena);
+void buddy_arena_drain(buddy_arena_t *arena);
+int buddy_arena_alloc_bulk(buddy_arena_t *arena, size_t size, int count, void **addrs);
+void buddy_arena_free_bulk(buddy_arena_t *arena, void **addrs, int count);
 
 #endif // BUDDY_H
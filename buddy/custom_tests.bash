@@ -1,6 +1,6 @@
 #!/bin/bash
 
 eval "make"
-eval "gcc -g -Wall -std=gnu11 -o test test.c buddy.c -lm"
+eval "gcc -g -Wall -std=gnu11 -o test test.c buddy.c slab.c numa.c handle.c -lpthread"
 
 
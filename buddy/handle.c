@@ -0,0 +1,368 @@
+/**
+ * Relocatable Handles
+ *
+ * Callers hold handles instead of addresses, and look the address up whenever
+ * they need it. Since nobody else holds the address, compaction is free to
+ * move the block: it slides every unpinned block down to the lowest free spot
+ * (buddy_arena_move_down), so the free pages at the top of the arena
+ * coalesce back into large blocks. Compaction runs on request, and by itself
+ * whenever an allocation from the arena would otherwise fail.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "handle.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+/* number of entries a handle table starts with. It doubles whenever it runs out */
+#define HANDLE_INITIAL_ENTRIES 64
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+/**
+ * What a handle stands for
+ */
+typedef struct {
+	void *addr;		///< Current address of the block, NULL if the entry is unused
+	unsigned int pins;	///< Number of handle_pin calls not yet undone. Pinned blocks never move
+	unsigned int next_free;	///< Unused entries only: handle of the next unused entry, 0 at the end
+} handle_entry_t;
+
+/**
+ * Handles to the relocatable blocks of an arena
+ */
+struct handle_table {
+	buddy_arena_t *arena;		///< Arena the blocks come from
+	pthread_mutex_t lock;		///< Guards the entries, and keeps blocks from moving while held
+	handle_entry_t *entries;	///< Entry of handle h at index h - 1
+	unsigned int num_entries;	///< Number of entries
+	unsigned int free_head;		///< Handle of the first unused entry, 0 if none
+	buddy_reclaim_fn prev_reclaim;	///< Reclaim callback the arena had before the table, chained to and restored on destroy
+	void *prev_reclaim_ctx;		///< Its context
+};
+
+//a block to move during compaction
+typedef struct {
+	void *addr;
+	buddy_handle_t handle;
+} handle_move_t;
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+//orders handle_move_t by descending address
+static int handle_move_cmp(const void *a, const void *b){
+	char *x = ((const handle_move_t *)a)->addr, *y = ((const handle_move_t *)b)->addr;
+
+	return (x < y) - (x > y);
+}
+
+//looks up the entry of a handle
+/*
+ * @param table the handle table
+ * @param handle the handle
+ * @return the entry, or NULL if the handle is not in use
+ */
+static handle_entry_t *handle_entry(handle_table_t *table, buddy_handle_t handle){
+	if(handle == 0 || handle > table->num_entries || !table->entries[handle-1].addr)
+		return NULL;
+	return &table->entries[handle-1];
+}
+
+//chains entries [first, end) onto the list of unused entries, lowest handle first
+/*
+ * @param table the handle table
+ * @param first index of the first entry
+ * @param end index one past the last entry
+ */
+static void handle_add_unused(handle_table_t *table, unsigned int first, unsigned int end){
+	unsigned int i;
+
+	for(i = end; i > first; i--){
+		table->entries[i-1].addr = NULL;
+		table->entries[i-1].pins = 0;
+		table->entries[i-1].next_free = table->free_head;
+		table->free_head = i;
+	}
+}
+
+//moves every unpinned block as low in the arena as it goes, highest first, with the table locked
+/*
+ * @param table the handle table
+ * @return the number of blocks moved
+ */
+static size_t handle_compact_locked(handle_table_t *table){
+	handle_move_t *moves;
+	size_t moved = 0;
+	unsigned int n = 0, i;
+
+	if(!(moves = malloc(table->num_entries * sizeof(*moves))))
+		return 0;
+
+	//cached blocks count as allocated, and would keep their buddies from coalescing
+	buddy_arena_drain(table->arena);
+
+	for(i = 0; i < table->num_entries; i++){
+		if(table->entries[i].addr && !table->entries[i].pins){
+			moves[n].addr = table->entries[i].addr;
+			moves[n].handle = i + 1;
+			n++;
+		}
+	}
+	qsort(moves, n, sizeof(*moves), handle_move_cmp);
+
+	//a block only moves below itself, into holes lower blocks do not fill, so one pass settles them all
+	for(i = 0; i < n; i++){
+		void *new_addr = buddy_arena_move_down(table->arena, moves[i].addr);
+
+		if(new_addr != moves[i].addr){
+			table->entries[moves[i].handle-1].addr = new_addr;
+			moved++;
+		}
+	}
+
+	free(moves);
+	return moved;
+}
+
+//compacts the arena when one of its allocations fails, see buddy_arena_set_reclaim. If nothing moves, the callback the table replaced gets its turn
+/*
+ * @param arena the arena
+ * @param size size of the failed request
+ * @param ctx the handle table
+ * @return nonzero if any block moved or the previous callback made room
+ */
+static int handle_reclaim(buddy_arena_t *arena, size_t size, void *ctx){
+	handle_table_t *table = ctx;
+	size_t moved = 0;
+
+	//the table is busy, possibly with this very compaction, or a handle_alloc that compacts by itself
+	if(pthread_mutex_trylock(&table->lock) == 0){
+		moved = handle_compact_locked(table);
+		pthread_mutex_unlock(&table->lock);
+	}
+
+	if(moved > 0)
+		return 1;
+	return table->prev_reclaim ? table->prev_reclaim(arena, size, table->prev_reclaim_ctx) : 0;
+}
+
+/**
+ * Create a handle table over an arena
+ *
+ * The table registers itself as the arena's reclaim callback, so any
+ * allocation from the arena that would fail compacts it first. A callback
+ * registered before is called when compaction moves nothing, and registered
+ * again when the table is destroyed, so tables over the same arena must be
+ * destroyed in the reverse order of their creation.
+ *
+ * @param arena the arena to allocate blocks from
+ * @return the handle table, or NULL if out of memory
+ */
+handle_table_t *handle_table_create(buddy_arena_t *arena)
+{
+	handle_table_t *table;
+
+	if(!(table = malloc(sizeof(*table))))
+		return NULL;
+	if(!(table->entries = malloc(HANDLE_INITIAL_ENTRIES * sizeof(*table->entries)))){
+		free(table);
+		return NULL;
+	}
+
+	table->arena = arena;
+	table->num_entries = HANDLE_INITIAL_ENTRIES;
+	table->free_head = 0;
+	handle_add_unused(table, 0, table->num_entries);
+	pthread_mutex_init(&table->lock, NULL);
+
+	buddy_arena_get_reclaim(arena, &table->prev_reclaim, &table->prev_reclaim_ctx);
+	buddy_arena_set_reclaim(arena, handle_reclaim, table);
+
+	return table;
+}
+
+/**
+ * Destroy a handle table, freeing every block still allocated through it
+ *
+ * @param table the handle table. May be NULL
+ */
+void handle_table_destroy(handle_table_t *table)
+{
+	unsigned int i;
+
+	if(!table)
+		return;
+
+	buddy_arena_set_reclaim(table->arena, table->prev_reclaim, table->prev_reclaim_ctx);
+	for(i = 0; i < table->num_entries; i++)
+		buddy_arena_free(table->arena, table->entries[i].addr);
+
+	pthread_mutex_destroy(&table->lock);
+	free(table->entries);
+	free(table);
+}
+
+/**
+ * Allocate a relocatable block
+ *
+ * If the arena has no block large enough, the table is compacted and the
+ * allocation retried.
+ *
+ * @param table the handle table
+ * @param size size in bytes
+ * @return the handle, or 0 if out of memory
+ */
+buddy_handle_t handle_alloc(handle_table_t *table, size_t size)
+{
+	buddy_handle_t handle;
+	void *addr;
+
+	pthread_mutex_lock(&table->lock);
+
+	if(!table->free_head){	//out of entries: double the table
+		handle_entry_t *entries = realloc(table->entries, 2 * table->num_entries * sizeof(*entries));
+
+		if(!entries){
+			pthread_mutex_unlock(&table->lock);
+			return 0;
+		}
+		table->entries = entries;
+		handle_add_unused(table, table->num_entries, 2 * table->num_entries);
+		table->num_entries *= 2;
+	}
+
+	//the arena's reclaim callback backs off while the table is locked, so compact here instead
+	if(!(addr = buddy_arena_alloc(table->arena, size)) && handle_compact_locked(table))
+		addr = buddy_arena_alloc(table->arena, size);
+	if(!addr){
+		pthread_mutex_unlock(&table->lock);
+		return 0;
+	}
+
+	handle = table->free_head;
+	table->free_head = table->entries[handle-1].next_free;
+	table->entries[handle-1].addr = addr;
+	table->entries[handle-1].pins = 0;
+
+	pthread_mutex_unlock(&table->lock);
+
+	return handle;
+}
+
+/**
+ * Free a relocatable block and its handle
+ *
+ * @param table the handle table
+ * @param handle the handle. 0 is ignored
+ */
+void handle_free(handle_table_t *table, buddy_handle_t handle)
+{
+	handle_entry_t *entry;
+
+	pthread_mutex_lock(&table->lock);
+	if((entry = handle_entry(table, handle))){
+		buddy_arena_free(table->arena, entry->addr);
+		entry->addr = NULL;
+		entry->pins = 0;
+		entry->next_free = table->free_head;
+		table->free_head = handle;
+	}
+	pthread_mutex_unlock(&table->lock);
+}
+
+/**
+ * Current address of a relocatable block
+ *
+ * The address stays valid until the next compaction, which any allocation
+ * from the arena may trigger. Pin the block to hold on to it for longer, or
+ * when other threads allocate from the arena.
+ *
+ * @param table the handle table
+ * @param handle the handle
+ * @return the address, or NULL if the handle is not in use
+ */
+void *handle_addr(handle_table_t *table, buddy_handle_t handle)
+{
+	handle_entry_t *entry;
+	void *addr = NULL;
+
+	pthread_mutex_lock(&table->lock);
+	if((entry = handle_entry(table, handle)))
+		addr = entry->addr;
+	pthread_mutex_unlock(&table->lock);
+
+	return addr;
+}
+
+/**
+ * Keep a relocatable block from moving and get its address
+ *
+ * Pins nest; the block may move again once every pin is undone with
+ * handle_unpin. Pinned blocks are skipped by compaction, so they should not
+ * stay pinned for long.
+ *
+ * @param table the handle table
+ * @param handle the handle
+ * @return the address, valid until the matching handle_unpin, or NULL if the handle is not in use
+ */
+void *handle_pin(handle_table_t *table, buddy_handle_t handle)
+{
+	handle_entry_t *entry;
+	void *addr = NULL;
+
+	pthread_mutex_lock(&table->lock);
+	if((entry = handle_entry(table, handle))){
+		entry->pins++;
+		addr = entry->addr;
+	}
+	pthread_mutex_unlock(&table->lock);
+
+	return addr;
+}
+
+/**
+ * Undo a handle_pin
+ *
+ * @param table the handle table
+ * @param handle the handle
+ */
+void handle_unpin(handle_table_t *table, buddy_handle_t handle)
+{
+	handle_entry_t *entry;
+
+	pthread_mutex_lock(&table->lock);
+	if((entry = handle_entry(table, handle)) && entry->pins)
+		entry->pins--;
+	pthread_mutex_unlock(&table->lock);
+}
+
+/**
+ * Compact the arena behind a handle table
+ *
+ * Every unpinned block is moved to the lowest free spot below it, highest
+ * block first, so free memory gathers at the top of the arena and coalesces
+ * into large blocks. Blocks allocated from the arena without a handle stay
+ * where they are.
+ *
+ * @param table the handle table
+ * @return the number of blocks moved
+ */
+size_t handle_compact(handle_table_t *table)
+{
+	size_t moved;
+
+	pthread_mutex_lock(&table->lock);
+	moved = handle_compact_locked(table);
+	pthread_mutex_unlock(&table->lock);
+
+	return moved;
+}
@@ -0,0 +1,23 @@
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+/* blocks reached through handles, so compaction may move them */
+typedef struct handle_table handle_table_t;
+
+/* a handle to a relocatable block. 0 is never a valid handle */
+typedef unsigned int buddy_handle_t;
+
+handle_table_t *handle_table_create(buddy_arena_t *arena);
+void handle_table_destroy(handle_table_t *table);
+buddy_handle_t handle_alloc(handle_table_t *table, size_t size);
+void handle_free(handle_table_t *table, buddy_handle_t handle);
+void *handle_addr(handle_table_t *table, buddy_handle_t handle);
+void *handle_pin(handle_table_t *table, buddy_handle_t handle);
+void handle_unpin(handle_table_t *table, buddy_handle_t handle);
+size_t handle_compact(handle_table_t *table);
+
+#endif // HANDLE_H
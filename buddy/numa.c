@@ -0,0 +1,358 @@
+/**
+ * NUMA Zones
+ *
+ * Gives every NUMA node a buddy arena (zone) of its own, with its own free
+ * lists and lock. Allocations are served from the calling thread's node and
+ * fall back to the other nodes by increasing distance. The same layout can be
+ * simulated over a single region with any number of fake nodes, so the
+ * behaviour can be exercised on a single-node machine.
+ */
+
+/**************************************************************************
+ * Conditional Compilation Options
+ **************************************************************************/
+#define _GNU_SOURCE	//for sched_getcpu
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "numa.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+/* memory policy binding pages to a set of nodes, from linux/mempolicy.h */
+#define MPOL_BIND 2
+
+/* distance of a node to itself and to any other node, as reported by the kernel (or assumed when it does not) */
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+/* number of bits in the node mask passed to mbind */
+#define NUMA_MASK_BITS (8 * (int)sizeof(unsigned long))
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+/**
+ * A zone per NUMA node
+ */
+struct numa_zones {
+	int nodes;					///< Number of nodes
+	bool fake;					///< Are the nodes simulated over a single region?
+	char *base;					///< Fake nodes only: start of the region
+	size_t slice;					///< Fake nodes only: bytes of the region given to each node
+	buddy_arena_t *arenas[NUMA_MAX_NODES];		///< The zone of each node
+	int fallback[NUMA_MAX_NODES][NUMA_MAX_NODES];	///< Per node: every node by increasing distance, starting with itself
+};
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+//number of NUMA nodes the kernel knows of, from /sys/devices/system/node/online (e.g. "0-1")
+static int numa_online_nodes(){
+	FILE *online = fopen("/sys/devices/system/node/online", "r");
+	int first = 0, last = 0;
+
+	if(!online)
+		return 1;
+	if(fscanf(online, "%d-%d", &first, &last) < 2)
+		last = first;
+	fclose(online);
+
+	return last + 1 > NUMA_MAX_NODES ? NUMA_MAX_NODES : last + 1;
+}
+
+//reads the distances from a node to all others from /sys/devices/system/node/nodeN/distance
+/*
+ * @param node the node
+ * @param nodes number of nodes
+ * @param distance receives the distance to every node. Filled with the
+ * local/remote defaults where the kernel does not say
+ */
+static void numa_read_distances(int node, int nodes, int *distance){
+	char path[64];
+	FILE *file;
+	int i;
+
+	for(i = 0; i < nodes; i++)
+		distance[i] = i == node ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/distance", node);
+	if(!(file = fopen(path, "r")))
+		return;
+	for(i = 0; i < nodes && fscanf(file, "%d", &distance[i]) == 1; i++)
+		;
+	fclose(file);
+}
+
+//orders the nodes by increasing distance from every node. ties go to the node with the closer number
+/*
+ * @param zones the zones
+ */
+static void numa_build_fallback(numa_zones_t *zones){
+	int distance[NUMA_MAX_NODES];
+	int node, i, j;
+
+	for(node = 0; node < zones->nodes; node++){
+		int *order = zones->fallback[node];
+
+		if(zones->fake){	//pretend nodes further apart in number are further apart in distance
+			for(i = 0; i < zones->nodes; i++)
+				distance[i] = NUMA_LOCAL_DISTANCE + NUMA_LOCAL_DISTANCE * abs(i - node);
+		}
+		else
+			numa_read_distances(node, zones->nodes, distance);
+
+		//insertion sort, the node count is small
+		for(i = 0; i < zones->nodes; i++){
+			int n = i;
+
+			for(j = i; j > 0; j--){
+				int prev = order[j-1];
+				if(distance[prev] < distance[n] || (distance[prev] == distance[n] && abs(prev - node) <= abs(n - node)))
+					break;
+				order[j] = prev;
+			}
+			order[j] = n;
+		}
+	}
+}
+
+/**
+ * Create a zone on every NUMA node of the machine
+ *
+ * Each zone is an mmap arena whose memory is bound to its node with mbind.
+ * Where binding is not possible the pages land wherever they are first
+ * touched, which is still the allocating thread's node most of the time.
+ *
+ * @param size_per_node number of bytes managed by each zone
+ * @param min_order block order of a single page (the smallest block)
+ * @param max_order largest block order
+ * @param flags BUDDY_ARENA_* flags for every zone
+ * @return the zones, or NULL if the parameters are invalid or out of memory
+ */
+numa_zones_t *numa_zones_create(size_t size_per_node, int min_order, int max_order, unsigned flags)
+{
+	numa_zones_t *zones;
+	int node;
+
+	if(!(zones = calloc(1, sizeof(*zones))))
+		return NULL;
+
+	zones->nodes = numa_online_nodes();
+	zones->fake = false;
+
+	for(node = 0; node < zones->nodes; node++){
+		buddy_arena_t *arena = buddy_arena_create_mmap(size_per_node, min_order, max_order, flags);
+		unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_BITS + 1] = { 0 };
+
+		if(!arena){
+			numa_zones_destroy(zones);
+			return NULL;
+		}
+		zones->arenas[node] = arena;
+
+		//best effort, nothing has touched the memory yet
+		mask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+		syscall(SYS_mbind, buddy_arena_base(arena), buddy_arena_size(arena), MPOL_BIND, mask, NUMA_MAX_NODES + 1, 0);
+	}
+
+	numa_build_fallback(zones);
+
+	return zones;
+}
+
+/**
+ * Simulate zones on several NUMA nodes over a single region
+ *
+ * The region is cut into one equal slice per fake node, aligned to the
+ * largest block where possible. A thread's node is taken to be the CPU it
+ * runs on modulo the number of nodes, and node distance grows with the
+ * difference in node numbers.
+ *
+ * @param base start of the region
+ * @param size number of bytes in the region
+ * @param nodes number of fake nodes
+ * @param min_order block order of a single page (the smallest block)
+ * @param max_order largest block order
+ * @param flags BUDDY_ARENA_* flags for every zone
+ * @return the zones, or NULL if the parameters are invalid or out of memory
+ */
+numa_zones_t *numa_zones_create_fake(void *base, size_t size, int nodes, int min_order, int max_order, unsigned flags)
+{
+	numa_zones_t *zones;
+	size_t align;
+	int node;
+
+	if(nodes < 1 || nodes > NUMA_MAX_NODES || min_order < 1 || max_order < min_order || max_order > BUDDY_ORDER_LIMIT)
+		return NULL;
+	if(!(zones = calloc(1, sizeof(*zones))))
+		return NULL;
+
+	zones->nodes = nodes;
+	zones->fake = true;
+	zones->base = base;
+
+	//keep the slices aligned to the largest block if they are big enough, otherwise to a page
+	align = (size_t)1 << (size / nodes >= ((size_t)1 << max_order) ? max_order : min_order);
+	zones->slice = (size / nodes) & ~(align - 1);
+
+	for(node = 0; node < nodes; node++){
+		if(!(zones->arenas[node] = buddy_arena_create_flags(zones->base + node * zones->slice, zones->slice, min_order, max_order, flags))){
+			numa_zones_destroy(zones);
+			return NULL;
+		}
+	}
+
+	numa_build_fallback(zones);
+
+	return zones;
+}
+
+/**
+ * Destroy a set of zones and their arenas
+ *
+ * @param zones the zones. May be NULL
+ */
+void numa_zones_destroy(numa_zones_t *zones)
+{
+	int node;
+
+	if(!zones)
+		return;
+	for(node = 0; node < zones->nodes; node++)
+		buddy_arena_destroy(zones->arenas[node]);
+	free(zones);
+}
+
+/**
+ * Number of nodes, and so of zones
+ *
+ * @param zones the zones
+ * @return the number of nodes
+ */
+int numa_zones_nodes(numa_zones_t *zones)
+{
+	return zones->nodes;
+}
+
+/**
+ * The arena serving a node
+ *
+ * @param zones the zones
+ * @param node the node
+ * @return the node's arena, or NULL if there is no such node
+ */
+buddy_arena_t *numa_zone_arena(numa_zones_t *zones, int node)
+{
+	if(node < 0 || node >= zones->nodes)
+		return NULL;
+	return zones->arenas[node];
+}
+
+/**
+ * The node the calling thread is running on
+ *
+ * @param zones the zones
+ * @return the node
+ */
+int numa_current_node(numa_zones_t *zones)
+{
+	unsigned int cpu = 0, node = 0;
+
+	if(zones->fake){
+		int current_cpu = sched_getcpu();
+		return current_cpu < 0 ? 0 : current_cpu % zones->nodes;
+	}
+
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || (int)node >= zones->nodes)
+		return 0;
+	return node;
+}
+
+/**
+ * The node whose zone an address belongs to
+ *
+ * @param zones the zones
+ * @param addr an address allocated from the zones
+ * @return the node, or -1 if the address is in none of the zones
+ */
+int numa_node_of(numa_zones_t *zones, const void *addr)
+{
+	int node;
+
+	if(zones->fake){
+		if((const char *)addr < zones->base)
+			return -1;
+		node = ((const char *)addr - zones->base) / zones->slice;
+		return node < zones->nodes ? node : -1;
+	}
+
+	for(node = 0; node < zones->nodes; node++){
+		char *base = buddy_arena_base(zones->arenas[node]);
+		if((const char *)addr >= base && (const char *)addr < base + buddy_arena_size(zones->arenas[node]))
+			return node;
+	}
+	return -1;
+}
+
+/**
+ * Allocate a memory block, preferring a node
+ *
+ * Nodes are tried by increasing distance from the preferred one until one of
+ * them can serve the request.
+ *
+ * @param zones the zones
+ * @param size size in bytes
+ * @param node the preferred node
+ * @return memory block address, or NULL if no node has a large enough block
+ */
+void *numa_alloc_node(numa_zones_t *zones, size_t size, int node)
+{
+	void *mem_addr = NULL;
+	int i;
+
+	if(node < 0 || node >= zones->nodes)
+		node = 0;
+
+	for(i = 0; i < zones->nodes && !mem_addr; i++)
+		mem_addr = buddy_arena_alloc(zones->arenas[zones->fallback[node][i]], size);
+
+	return mem_addr;
+}
+
+/**
+ * Allocate a memory block, preferring the calling thread's node
+ *
+ * @param zones the zones
+ * @param size size in bytes
+ * @return memory block address, or NULL if no node has a large enough block
+ */
+void *numa_alloc(numa_zones_t *zones, size_t size)
+{
+	return numa_alloc_node(zones, size, numa_current_node(zones));
+}
+
+/**
+ * Free a memory block back to the zone it came from
+ *
+ * @param zones the zones
+ * @param addr memory block address. NULL is ignored
+ */
+void numa_free(numa_zones_t *zones, void *addr)
+{
+	int node;
+
+	if(!addr || (node = numa_node_of(zones, addr)) < 0)
+		return;
+	buddy_arena_free(zones->arenas[node], addr);
+}
@@ -0,0 +1,25 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+/* most NUMA nodes a set of zones may span */
+#define NUMA_MAX_NODES 64
+
+/* one buddy arena (zone) per NUMA node, allocating node-local first */
+typedef struct numa_zones numa_zones_t;
+
+numa_zones_t *numa_zones_create(size_t size_per_node, int min_order, int max_order, unsigned flags);
+numa_zones_t *numa_zones_create_fake(void *base, size_t size, int nodes, int min_order, int max_order, unsigned flags);
+void numa_zones_destroy(numa_zones_t *zones);
+int numa_zones_nodes(numa_zones_t *zones);
+buddy_arena_t *numa_zone_arena(numa_zones_t *zones, int node);
+int numa_current_node(numa_zones_t *zones);
+int numa_node_of(numa_zones_t *zones, const void *addr);
+void *numa_alloc(numa_zones_t *zones, size_t size);
+void *numa_alloc_node(numa_zones_t *zones, size_t size, int node);
+void numa_free(numa_zones_t *zones, void *addr);
+
+#endif // NUMA_H
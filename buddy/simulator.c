@@ -1,13 +1,27 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "buddy.h"
+#include "handle.h"
+#include "trace.h"
+
+/* records read at a time from binary traces that cannot be mapped, e.g. pipes */
+#define TRACE_CHUNK 65536
+
+/* characters a variable name of a text trace is made of */
+#define NAME_CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_"
 
 /**
  * Various program statuses indicating success or failure of an operation
@@ -33,28 +47,352 @@ typedef enum severity_t {
  */
 typedef struct var_t {
 	void* mem;   ///< A pointer to a memory block
+	buddy_handle_t handle; ///< Handle of the memory block when allocating through handles (-c)
+	size_t size; ///< Bytes requested for the memory block
 	bool in_use; ///< Is this variable currently in use? This is probably redundant if we assume variables not in use are NULL. For now just leave it as it is
 } var_t;
 
 
 static FILE *in = NULL;    // Input file
-static var_t var_map[256]; // Keep track of variable allocations
 static int linenum = 0;    // Line number in input file
+static bool exact = false; // Allocate exactly the pages requested (buddy_alloc_exact)
+static bool report_frag = false; // Print the fragmentation index once the input is done
+static bool dump_json = false; // Print the free blocks after every command as JSON (-j)
+static long dump_every = -1; // Print the free blocks after every this many commands, 0 never (-d). Defaults to 1 for text traces and 0 for binary ones
+static long commands = 0; // Commands run so far
+static handle_table_t *handles = NULL; // Allocate through relocatable handles, so failing allocations compact memory (-c)
+static buddy_arena_t *arena = NULL; // Arena to allocate from: the default arena, or an mmap arena of the size given with -m
+static FILE *timeline = NULL; // CSV timeline of the memory after every command (-t)
+static size_t live_requested = 0; // Bytes requested for the blocks currently allocated
+static var_t *ids = NULL; // Variables of a binary trace, indexed by id
+static size_t num_ids = 0; // Number of entries in ids
+
+/**
+ * Counters of a binary trace replay
+ */
+static struct {
+	size_t allocs;       ///< Allocation records
+	size_t frees;        ///< Free records of variables in use
+	size_t failed;       ///< Allocations that ran out of memory
+	size_t reallocs;     ///< Allocation records of variables in use, which free the old block first
+	size_t double_frees; ///< Free records of variables not in use
+	size_t bad;          ///< Records with an unknown operation
+} replay;
+
+
+/**
+ * Extremes seen over the timeline
+ */
+static struct {
+	long ops;                  ///< Rows written
+	size_t peak_requested;     ///< Most bytes requested for live blocks
+	long peak_requested_op;    ///< Row it was first reached at
+	size_t peak_granted;       ///< Most bytes granted for live blocks
+	long peak_granted_op;      ///< Row it was first reached at
+	double worst_frag;         ///< Highest fragmentation index
+	long worst_frag_op;        ///< Row it was first reached at
+	size_t worst_frag_free;    ///< Free bytes at that row
+	size_t worst_frag_largest; ///< Largest free block at that row
+	size_t oom_capacity;       ///< Failed allocations needing more than all free memory, or a block larger than the arena's largest
+	size_t oom_fragmentation;  ///< Failed allocations whose block would have fit in the free memory, had it been one block
+} tl;
+
+/**
+ * Entry of the table of variable names
+ */
+typedef struct name_entry_t {
+	char* name;  ///< Name of the variable, NULL if the entry is unused
+	uint32_t id; ///< Id of the variable, its index in ids
+} name_entry_t;
+
+static name_entry_t *names = NULL; // Open-addressing hash table from the variable names of a text trace to their ids
+static size_t names_cap = 0; // Number of entries in names, a power of two
+static size_t names_used = 0; // Number of names in names, and so the id of the next new name
+
+/**
+ * Placement policies selectable with -p, by name
+ */
+static const struct {
+	const char* name;
+	buddy_placement_t placement;
+} placements[] = {
+	{ "fifo", BUDDY_PLACEMENT_FIFO },
+	{ "lifo", BUDDY_PLACEMENT_LIFO },
+	{ "address", BUDDY_PLACEMENT_ADDRESS },
+	{ "buddy", BUDDY_PLACEMENT_BUDDY_BUSY },
+};
+static buddy_placement_t placement = BUDDY_PLACEMENT_FIFO; // Placement policy of the buddy allocator
+
+
+/**
+ * Resolve a variable by id, growing the table as needed
+ *
+ * @param id Id of the variable
+ * @return Returns a pointer to the variable, or NULL if out of memory
+ */
+static var_t* get_id_var(uint32_t id)
+{
+	if (id >= num_ids) {
+		size_t n = num_ids ? num_ids : 1024;
+		var_t* grown;
+
+		while (n <= id)
+			n *= 2;
+		if ((grown = realloc(ids, n * sizeof(*ids))) == NULL)
+			return NULL;
+		memset(grown + num_ids, 0, (n - num_ids) * sizeof(*ids));
+		ids = grown;
+		num_ids = n;
+	}
+	return &ids[id];
+}
+
+/**
+ * Hash a variable name (FNV-1a)
+ *
+ * @param name Name of the variable, not necessarily NUL-terminated
+ * @param len Length of the name
+ * @return Returns the hash
+ */
+static size_t name_hash(const char* name, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
 
+	for (i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+	return hash;
+}
 
 /**
- * Resolve a variable by name
+ * Find the entry of a name, or the unused entry where it belongs
  *
- * @param var Name of variable
+ * @param name Name of the variable
+ * @param len Length of the name
+ * @return Returns the entry. names must have an unused entry
+ */
+static name_entry_t* name_slot(const char* name, size_t len)
+{
+	size_t i = name_hash(name, len) & (names_cap - 1);
+
+	while (names[i].name != NULL && (strncmp(names[i].name, name, len) != 0 || names[i].name[len] != '\0'))
+		i = (i + 1) & (names_cap - 1);
+	return &names[i];
+}
+
+/**
+ * Double the table of variable names, rehashing every name
+ *
+ * @return Returns false if out of memory
+ */
+static bool names_grow()
+{
+	name_entry_t* old = names;
+	size_t old_cap = names_cap, i;
+
+	if ((names = calloc(old_cap ? 2 * old_cap : 1024, sizeof(*names))) == NULL) {
+		names = old;
+		return false;
+	}
+	names_cap = old_cap ? 2 * old_cap : 1024;
+
+	for (i = 0; i < old_cap; ++i)
+		if (old[i].name != NULL)
+			*name_slot(old[i].name, strlen(old[i].name)) = old[i];
+	free(old);
+	return true;
+}
+
+/**
+ * Resolve a variable by name, giving new names the next free id
+ *
+ * @param name Name of the variable, not necessarily NUL-terminated
+ * @param len Length of the name
  * @return Returns a pointer to location of the variable's
- * representation. Returns NULL if the var is not an alphabetic character.
+ * representation. Returns NULL if the name is empty or not made of
+ * NAME_CHARS, or if out of memory.
  */
-static var_t* get_var(char var)
+static var_t* get_var(const char* name, size_t len)
 {
-	if ((var >= 'a' && var <= 'z') || (var >= 'A' && var <= 'Z'))
-		return &var_map[(int) var];
-	else
+	name_entry_t* entry;
+
+	if (len == 0 || strspn(name, NAME_CHARS) < len)
+		return NULL;
+
+	// keep the table at most half full, so probe sequences stay short
+	if (2 * (names_used + 1) > names_cap && !names_grow())
 		return NULL;
+
+	entry = name_slot(name, len);
+	if (entry->name == NULL) {
+		if ((entry->name = malloc(len + 1)) == NULL)
+			return NULL;
+		memcpy(entry->name, name, len);
+		entry->name[len] = '\0';
+		entry->id = names_used++;
+	}
+	return get_id_var(entry->id);
+}
+
+/**
+ * Write the CSV header of the timeline
+ */
+static void timeline_header()
+{
+	buddy_stats_t stats;
+	int o;
+
+	buddy_arena_stats(arena, &stats);
+	fprintf(timeline, "op,command,size,failed,live_requested,live_granted,free_bytes");
+	for (o = stats.min_order; o <= stats.max_order; ++o) {
+		if (o < 10)
+			fprintf(timeline, ",free_%dB", 1 << o);
+		else
+			fprintf(timeline, ",free_%zuK", ((size_t)1 << o) / 1024);
+	}
+	fprintf(timeline, ",largest_free,fragmentation\n");
+}
+
+/**
+ * Append the state of memory after a command to the timeline
+ *
+ * The fragmentation index is 1 - largest free block / free bytes, as for
+ * buddy_arena_fragmentation.
+ *
+ * @param command "alloc" or "free"
+ * @param size Bytes the command requested or freed
+ * @param needed Bytes the allocation needed from the arena, see alloc_needed. Only used if it failed
+ * @param failed Did the allocation run out of memory?
+ */
+static void timeline_record(const char* command, size_t size, size_t needed, bool failed)
+{
+	buddy_stats_t stats;
+	size_t free_bytes = 0, largest;
+	double frag;
+	int o;
+
+	buddy_arena_stats(arena, &stats);
+	for (o = stats.min_order; o <= stats.max_order; ++o)
+		free_bytes += (size_t)stats.free_blocks[o] << o;
+	largest = stats.largest_free_order < 0 ? 0 : (size_t)1 << stats.largest_free_order;
+	frag = free_bytes ? 1.0 - (double)largest / free_bytes : 0.0;
+
+	++tl.ops;
+	fprintf(timeline, "%ld,%s,%zu,%d,%zu,%zu,%zu", tl.ops, command, size, failed, live_requested, stats.in_use, free_bytes);
+	for (o = stats.min_order; o <= stats.max_order; ++o)
+		fprintf(timeline, ",%zu", (size_t)stats.free_blocks[o] << o);
+	fprintf(timeline, ",%zu,%.4f\n", largest, frag);
+
+	if (live_requested > tl.peak_requested) {
+		tl.peak_requested = live_requested;
+		tl.peak_requested_op = tl.ops;
+	}
+	if (stats.in_use > tl.peak_granted) {
+		tl.peak_granted = stats.in_use;
+		tl.peak_granted_op = tl.ops;
+	}
+	if (frag > tl.worst_frag) {
+		tl.worst_frag = frag;
+		tl.worst_frag_op = tl.ops;
+		tl.worst_frag_free = free_bytes;
+		tl.worst_frag_largest = largest;
+	}
+	if (failed && free_bytes >= needed && needed <= (size_t)1 << stats.max_order)
+		++tl.oom_fragmentation;
+	else if (failed)
+		++tl.oom_capacity;
+}
+
+/**
+ * Print the extremes of the timeline
+ *
+ * @param path Where the timeline was written
+ */
+static void print_timeline_summary(const char* path)
+{
+	printf("Timeline: %ld operations written to %s\n", tl.ops, path);
+	printf("Peak live requested: %zu bytes at operation %ld\n", tl.peak_requested, tl.peak_requested_op);
+	printf("Peak live granted: %zu bytes at operation %ld\n", tl.peak_granted, tl.peak_granted_op);
+	printf("Worst fragmentation index: %.3f at operation %ld (%zu bytes free, largest block %zu bytes)\n",
+	       tl.worst_frag, tl.worst_frag_op, tl.worst_frag_free, tl.worst_frag_largest);
+	printf("Out of memory: %zu from fragmentation (enough bytes free, but no block large enough), %zu from capacity\n",
+	       tl.oom_fragmentation, tl.oom_capacity);
+}
+
+/**
+ * Bytes an allocation takes from the arena: whole pages in -x mode, the
+ * power-of-two block holding it otherwise
+ *
+ * @param size Size in bytes
+ * @return Returns the bytes needed, at least a page
+ */
+static size_t alloc_needed(size_t size)
+{
+	size_t page = buddy_arena_page_size(arena);
+	size_t needed = page;
+
+	if (exact && !handles)
+		return size > page ? (size + page - 1) / page * page : page;
+	while (needed < size && needed <= SIZE_MAX / 2)
+		needed <<= 1;
+	return needed;
+}
+
+/**
+ * Allocate the block of a variable
+ *
+ * @param var The variable
+ * @param size Size in bytes
+ * @return Returns true on success, false if out of memory
+ */
+static bool var_alloc(var_t* var, size_t size)
+{
+	if (handles) {
+		var->handle = handle_alloc(handles, size);
+		var->mem = handle_addr(handles, var->handle);
+	}
+	else
+		var->mem = exact ? buddy_arena_alloc_exact(arena, size) : buddy_arena_alloc(arena, size);
+
+	if (var->mem != NULL) {
+		var->in_use = true;
+		var->size = size;
+		live_requested += size;
+	}
+	if (timeline)
+		timeline_record("alloc", size, alloc_needed(size), var->mem == NULL);
+	return var->mem != NULL;
+}
+
+/**
+ * Free the block of a variable in use
+ *
+ * @param var The variable
+ */
+static void var_free(var_t* var)
+{
+	if (handles)
+		handle_free(handles, var->handle);
+	else
+		buddy_arena_free(arena, var->mem);
+	var->mem = NULL;
+	var->in_use = false;
+	live_requested -= var->size;
+	if (timeline)
+		timeline_record("free", var->size, 0, false);
+}
+
+/**
+ * Print the free blocks, if a dump is due after this command
+ */
+static void dump_sampled()
+{
+	if (dump_every <= 0 || ++commands % dump_every != 0)
+		return;
+	if (dump_json)
+		buddy_arena_dump_json(arena);
+	else
+		buddy_arena_dump(arena);
 }
 
 /**
@@ -106,16 +444,16 @@ static status_t parse_alloc(char* cmd)
 	assert(cmd != NULL);
 	assert(cmd[0] != '\0');
 
-	char var_name;
+	size_t name_len = strspn(cmd, NAME_CHARS);
 	int size;
 	char alter_size;
 	int matched;
 
 	errno = 0;
-	matched = sscanf(cmd, "%c=alloc(%d%c)", &var_name, &size, &alter_size);
+	matched = sscanf(cmd + name_len, "=alloc(%d%c)", &size, &alter_size);
 
 	// Error check sprintf
-	if (matched == 3 && errno == 0) {
+	if (matched == 2 && errno == 0) {
 		// Check what the alter_size variable actually contains
 		switch (alter_size) {
 		case 'k':
@@ -132,22 +470,18 @@ static status_t parse_alloc(char* cmd)
 	}
 
 	// Resolve variable
-	var_t* var = get_var(var_name);
+	var_t* var = get_var(cmd, name_len);
 
 	if (var == NULL)
 		return parse_error(cmd);
 
 	// Allocate variable
-	var->mem = buddy_alloc(size);
-
-	if (var->mem == NULL) {
+	if (!var_alloc(var, size)) {
 		print_fault(cmd, "buddy_alloc returned NULL", WARNING);
 		printf("Out of memory\n");
 		return OUTOFMEMORY;
 	}
 
-	var->in_use = true;
-
 	return SUCCESS;
 }
 
@@ -161,16 +495,16 @@ static status_t parse_free(char* cmd)
 {
 	assert(cmd != NULL);
 
-	char var_name;
-	int matched;
+	size_t name_len;
 	var_t* var;
 
 	// Read the command string
-	errno = 0;
-	matched = sscanf(cmd, "free(%c)", &var_name);
+	if (strncmp(cmd, "free(", 5) != 0)
+		return parse_error(cmd);
+	name_len = strspn(cmd + 5, NAME_CHARS);
 
-	// Check if sscanf was valid
-	if (matched != 1 || errno != 0 || (var = get_var(var_name)) == NULL)
+	// Check if the command was valid
+	if (strcmp(cmd + 5 + name_len, ")") != 0 || (var = get_var(cmd + 5, name_len)) == NULL)
 		return parse_error(cmd);
 
 	// Ensure that the variable is in use
@@ -180,9 +514,7 @@ static status_t parse_free(char* cmd)
 	}
 
 	// Free variable
-	buddy_free(var->mem);
-	var->mem = NULL;
-	var->in_use = false;
+	var_free(var);
 
 	return SUCCESS;
 }
@@ -218,14 +550,15 @@ static status_t parse_command(char* cmd, int cmd_len)
 			cmd[ws_cursor++] = cmd[i];
 		}
 	}
+	cmd[ws_cursor] = '\0';
 
 	status_t status;
 
-	// We have 2 commands: alloc and free.
-	if (strstr(cmd, "alloc") != NULL)
-		status = parse_alloc(cmd);
-	else if (strstr(cmd, "free") != NULL)
+	// We have 2 commands: alloc and free. Variables may be called either
+	if (strncmp(cmd, "free(", 5) == 0)
 		status = parse_free(cmd);
+	else if (strstr(cmd, "=alloc(") != NULL)
+		status = parse_alloc(cmd);
 	else
 		return parse_error(cmd);
 
@@ -233,7 +566,7 @@ static status_t parse_command(char* cmd, int cmd_len)
 		return status;
 
 	// Output free blocks
-	buddy_dump();
+	dump_sampled();
 
 	return SUCCESS;
 }
@@ -253,12 +586,143 @@ static status_t parse_file()
 
 	while (status == SUCCESS && (read = getline(&line, &len, in)) > 0) {
 		++linenum;
-		status = parse_command(line, len);
+		status = parse_command(line, read);	//the line itself, not the whole buffer
 	}
 	free(line);
 	return status;
 }
 
+/**
+ * Run the records of a binary trace
+ *
+ * Unlike text traces, running out of memory or freeing a variable not in use
+ * only counts against the replay, which carries on. Allocating a variable in
+ * use frees its old block first, so nothing leaks and the live bytes stay
+ * exact.
+ *
+ * @param records The records
+ * @param n Number of records
+ */
+static void replay_records(const trace_record_t* records, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		var_t* var = get_id_var(records[i].var);
+
+		if (var == NULL || (records[i].op != TRACE_OP_ALLOC && records[i].op != TRACE_OP_FREE)) {
+			replay.bad++;
+			continue;
+		}
+
+		if (records[i].op == TRACE_OP_ALLOC) {
+			if (var->in_use) {
+				replay.reallocs++;
+				var_free(var);
+			}
+			replay.allocs++;
+			if (!var_alloc(var, records[i].size))
+				replay.failed++;
+		}
+		else if (var->in_use) {
+			replay.frees++;
+			var_free(var);
+		}
+		else
+			replay.double_frees++;
+
+		dump_sampled();
+	}
+}
+
+/**
+ * Replay a binary trace (see trace.h)
+ *
+ * Regular files are mapped whole; anything else, such as a pipe, is streamed
+ * in chunks of TRACE_CHUNK records.
+ *
+ * @param path Path of the trace, or "-" for standard input
+ * @return Program status.
+ */
+static status_t replay_file(const char* path)
+{
+	char magic[TRACE_MAGIC_LEN];
+	trace_record_t* chunk;
+	struct stat st;
+	size_t n;
+	FILE* file;
+	int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+
+	if (fd < 0) {
+		perror("ERROR: Failed to open binary trace");
+		return BADINPUT;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= TRACE_MAGIC_LEN) {
+		char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (map != MAP_FAILED) {
+			status_t status = BADINPUT;
+
+			if (memcmp(map, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				replay_records((const trace_record_t*)(map + TRACE_MAGIC_LEN), (st.st_size - TRACE_MAGIC_LEN) / sizeof(trace_record_t));
+				status = SUCCESS;
+			}
+			else
+				fprintf(stderr, "ERROR: %s is not a binary trace\n", path);
+
+			munmap(map, st.st_size);
+			close(fd);
+			return status;
+		}
+	}
+
+	if ((file = fdopen(fd, "rb")) == NULL || (chunk = malloc(TRACE_CHUNK * sizeof(*chunk))) == NULL) {
+		perror("ERROR: Failed to read binary trace");
+		if (file)
+			fclose(file);
+		else
+			close(fd);
+		return BADINPUT;
+	}
+
+	if (fread(magic, 1, TRACE_MAGIC_LEN, file) != TRACE_MAGIC_LEN || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+		fprintf(stderr, "ERROR: %s is not a binary trace\n", path);
+		free(chunk);
+		fclose(file);
+		return BADINPUT;
+	}
+	while ((n = fread(chunk, sizeof(*chunk), TRACE_CHUNK, file)) > 0)
+		replay_records(chunk, n);
+
+	free(chunk);
+	fclose(file);
+	return SUCCESS;
+}
+
+/**
+ * Print the throughput and the state of memory after a binary trace replay
+ *
+ * @param seconds Time the replay took
+ */
+static void print_replay_summary(double seconds)
+{
+	size_t ops = replay.allocs + replay.frees + replay.double_frees + replay.bad;
+	buddy_stats_t stats;
+
+	buddy_arena_stats(arena, &stats);
+
+	printf("Replayed %zu operations in %.3f s: %.2f Mops/s\n", ops, seconds, seconds > 0 ? ops / seconds / 1e6 : 0.0);
+	printf("Allocations: %zu, out of memory: %zu, of variables in use: %zu\n", replay.allocs, replay.failed, replay.reallocs);
+	printf("Frees: %zu, of variables not in use: %zu\n", replay.frees, replay.double_frees);
+	if (replay.bad)
+		printf("Bad records: %zu\n", replay.bad);
+	printf("Peak in use: %zu bytes, internal fragmentation: %.1f%%\n", stats.peak_in_use,
+	       stats.bytes_granted ? 100.0 * (stats.bytes_granted - stats.bytes_requested) / stats.bytes_granted : 0.0);
+	printf("Fragmentation index: %.3f\n", buddy_arena_fragmentation(arena));
+}
+
 
 /**
  * Output program manual
@@ -269,31 +733,108 @@ static status_t parse_file()
 void print_usage(char* prog_name, FILE* out)
 {
 	fprintf(out, "Usage:\n");
-	fprintf(out, "  ./%s [-i filename]\n", prog_name);
+	fprintf(out, "  ./%s [-i filename | -b filename] [-x] [-p policy] [-f] [-c] [-j] [-d n] [-m MB] [-t csvfile]\n", prog_name);
 	fprintf(out, "     -i [optional] - Specify an input file name to read from. If this option \n");
 	fprintf(out, "                     is not used then input is expected from standard input.\n");
+	fprintf(out, "     -b [optional] - Replay a binary trace instead, '-' for standard input, and \n");
+	fprintf(out, "                     print the throughput and fragmentation once it is done.\n");
+	fprintf(out, "     -x [optional] - Allocate exactly the pages requested instead of rounding \n");
+	fprintf(out, "                     up to a power of two.\n");
+	fprintf(out, "     -p [optional] - Placement policy choosing among free blocks of an order: \n");
+	fprintf(out, "                     fifo (default), lifo, address or buddy.\n");
+	fprintf(out, "     -f [optional] - Print the fragmentation index of the free memory once the \n");
+	fprintf(out, "                     input is done.\n");
+	fprintf(out, "     -c [optional] - Allocate through relocatable handles, compacting memory \n");
+	fprintf(out, "                     when an allocation would fail. Overrides -x.\n");
+	fprintf(out, "     -j [optional] - Print the free blocks after every command as a line of \n");
+	fprintf(out, "                     JSON instead of N:SIZEK pairs.\n");
+	fprintf(out, "     -d [optional] - Print the free blocks after every n commands, 0 for never. \n");
+	fprintf(out, "                     Defaults to 1, or 0 with -b.\n");
+	fprintf(out, "     -m [optional] - Allocate from a fresh arena of this many megabytes instead \n");
+	fprintf(out, "                     of the default 1MB one.\n");
+	fprintf(out, "     -t [optional] - Write the memory use and fragmentation after every command \n");
+	fprintf(out, "                     to a CSV file, and print its peaks once the input is done.\n");
 }
 
 int main(int argc, char** argv)
 {
 	int opt;
+	size_t i;
+	bool compact = false;
+	const char* binary = NULL;
+	const char* timeline_path = NULL;
+	size_t arena_mb = 0;
+	struct timespec start, end;
 
 	status_t prog_status;
 
 	in = stdin;
 
 	// Parse command line options
-	while ((opt = getopt(argc, argv, "i:")) != -1) {
+	while ((opt = getopt(argc, argv, "i:b:xp:fcjd:m:t:")) != -1) {
 		switch (opt) {
 		case 'i':
 			in = fopen(optarg, "r");
 			break;
 
+		case 'b':
+			binary = optarg;
+			break;
+
+		case 'x':
+			exact = true;
+			break;
+
+		case 'p':
+			for (i = 0; i < sizeof(placements) / sizeof(placements[0]); ++i)
+				if (strcmp(optarg, placements[i].name) == 0)
+					break;
+			if (i == sizeof(placements) / sizeof(placements[0])) {
+				fprintf(stderr, "ERROR: Unknown placement policy '%s'\n", optarg);
+				print_usage(argv[0], stdout);
+				return EXIT_FAILURE;
+			}
+			placement = placements[i].placement;
+			break;
+
+		case 'f':
+			report_frag = true;
+			break;
+
+		case 'c':
+			compact = true;
+			break;
+
+		case 'j':
+			dump_json = true;
+			break;
+
+		case 'd':
+			dump_every = atol(optarg);
+			break;
+
+		case 'm':
+			arena_mb = strtoul(optarg, NULL, 10);
+			break;
+
+		case 't':
+			timeline_path = optarg;
+			break;
+
 		case '?':
 			switch (optopt) {
 			case 'i':
+			case 'b':
+			case 't':
 				fprintf(stderr, "ERROR: Missing filename after '%c'", optopt);
 				return EXIT_FAILURE;
+			case 'd':
+			case 'm':
+				fprintf(stderr, "ERROR: Missing number after '%c'", optopt);
+				return EXIT_FAILURE;
+			case 'p':
+				fprintf(stderr, "ERROR: Missing placement policy after '%c'", optopt);
+				return EXIT_FAILURE;
 			}
 
 			print_usage(argv[0], stdout);
@@ -307,16 +848,68 @@ int main(int argc, char** argv)
 		return EXIT_FAILURE;
 	}
 
-	// Zero memory
-	memset(var_map, 0, sizeof(var_map));
-
 	// Execute program
 	buddy_init();
-	prog_status = parse_file();
+	arena = buddy_default_arena();
+	if (arena_mb) {
+		size_t arena_size = arena_mb << 20;
+		int max_order = 20;
+
+		while (max_order < BUDDY_ORDER_LIMIT && ((size_t)2 << max_order) <= arena_size)
+			++max_order;
+		if ((arena = buddy_arena_create_mmap(arena_size, 12, max_order, 0)) == NULL) {
+			perror("ERROR: Failed to create the arena.");
+			return EXIT_FAILURE;
+		}
+	}
+	buddy_arena_set_placement(arena, placement);
+	if (compact && (handles = handle_table_create(arena)) == NULL) {
+		perror("ERROR: Failed to create the handle table.");
+		return EXIT_FAILURE;
+	}
+
+	if (timeline_path) {
+		if ((timeline = fopen(timeline_path, "w")) == NULL) {
+			perror("ERROR: Failed to open the timeline file.");
+			return EXIT_FAILURE;
+		}
+		timeline_header();
+	}
+
+	if (binary) {
+		if (dump_every < 0)
+			dump_every = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		prog_status = replay_file(binary);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (prog_status == SUCCESS)
+			print_replay_summary((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	}
+	else {
+		if (dump_every < 0)
+			dump_every = 1;
+		prog_status = parse_file();
+	}
+
+	if (report_frag && !binary)
+		printf("Fragmentation index: %.3f\n", buddy_arena_fragmentation(arena));
+
+	if (timeline) {
+		fclose(timeline);
+		print_timeline_summary(timeline_path);
+	}
 
 	if (in != stdin)
 		fclose(in);
 
+	handle_table_destroy(handles);
+	if (arena != buddy_default_arena())
+		buddy_arena_destroy(arena);
+	for (i = 0; i < names_cap; ++i)
+		free(names[i].name);
+	free(names);
+	free(ids);
+
 	if (prog_status == SUCCESS)
 		return EXIT_SUCCESS;
 	else
@@ -0,0 +1,268 @@
+/**
+ * Slab Allocator
+ *
+ * Serves objects much smaller than a page by carving buddy pages into
+ * fixed-size slots. Every size class keeps a list of its partially used
+ * slabs; a slab whose objects are all free goes straight back to the buddy
+ * system.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "slab.h"
+#include "list.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+/* object alignment, and the granularity of the size to class lookup */
+#define SLAB_ALIGN 16
+
+/* largest object size a slab class may serve */
+#define SLAB_MAX_SIZE 2048
+
+/* a size class is only worth a slab if the page holds at least this many objects */
+#define SLAB_MIN_OBJS 2
+
+/* number of 64 bit words in a free bitmap of n objects */
+#define SLAB_MAP_WORDS(n) (((n) + 63) / 64)
+
+/* round x up to a multiple of SLAB_ALIGN */
+#define SLAB_ALIGN_UP(x) (((x) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+/* object sizes of the slab classes, roughly 15% apart so an object wastes little of its slot */
+static const unsigned short slab_sizes[] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+	320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+#define SLAB_NUM_CLASSES ((int)(sizeof(slab_sizes) / sizeof(slab_sizes[0])))
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+/**
+ * Header at the start of every slab page, followed by the free bitmap and then
+ * the objects
+ */
+typedef struct {
+	struct list_head list;	///< Link in the partial list of the size class, while the slab has free objects
+	unsigned int class_idx;	///< Size class of the objects
+	unsigned int free_objs;	///< Number of free objects
+	uint64_t free_map[];	///< Bit i is set if object i is free
+} slab_t;
+
+/**
+ * Size class: every object in its slabs has the same size
+ */
+typedef struct {
+	struct list_head partial;	///< Slabs with at least one free object
+	unsigned int obj_size;		///< Size of an object
+	unsigned int objs_per_slab;	///< Number of objects in a slab
+	size_t objs_offset;		///< Offset of the first object from the start of the slab
+} slab_class_t;
+
+/**
+ * Slab allocator over a buddy arena
+ */
+struct slab_cache {
+	buddy_arena_t *arena;		///< Arena the slab pages come from
+	size_t page_size;		///< Size of a slab, one arena page
+	pthread_mutex_t lock;		///< Guards the slabs and partial lists
+	int num_classes;		///< Number of usable size classes. Larger objects take whole buddy blocks
+	unsigned char class_of[SLAB_MAX_SIZE / SLAB_ALIGN + 1];	///< Size class index by object size in SLAB_ALIGN units (rounded up)
+	slab_class_t classes[SLAB_NUM_CLASSES];
+};
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+//lays out a slab of the given class: how many objects fit in a page together with the header and free bitmap
+/*
+ * @param cache the slab cache
+ * @param class the class to lay out. obj_size must be set
+ */
+static void slab_class_layout(slab_cache_t *cache, slab_class_t *class){
+	unsigned int n = (cache->page_size - sizeof(slab_t)) / class->obj_size;
+
+	while(n > 0 && SLAB_ALIGN_UP(sizeof(slab_t) + SLAB_MAP_WORDS(n) * sizeof(uint64_t)) + (size_t)n * class->obj_size > cache->page_size)
+		n--;
+	class->objs_per_slab = n;
+	class->objs_offset = SLAB_ALIGN_UP(sizeof(slab_t) + SLAB_MAP_WORDS(n) * sizeof(uint64_t));
+}
+
+//takes a new page from the buddy system and sets it up as an empty slab of the given class
+/*
+ * @param cache the slab cache
+ * @param class_idx the size class of the slab
+ * @return the slab, or NULL if the arena is out of memory
+ */
+static slab_t *slab_grow(slab_cache_t *cache, int class_idx){
+	slab_class_t *class = &cache->classes[class_idx];
+	slab_t *slab = buddy_arena_alloc(cache->arena, cache->page_size);
+	unsigned int w;
+
+	if(!slab)
+		return NULL;
+
+	slab->class_idx = class_idx;
+	slab->free_objs = class->objs_per_slab;
+	for(w = 0; w < SLAB_MAP_WORDS(class->objs_per_slab); w++)
+		slab->free_map[w] = ~(uint64_t)0;
+	if(class->objs_per_slab % 64)	//objects past the end of the slab are never free
+		slab->free_map[w-1] = ((uint64_t)1 << (class->objs_per_slab % 64)) - 1;
+	list_add(&slab->list, &class->partial);
+
+	return slab;
+}
+
+/**
+ * Create a slab allocator over an arena
+ *
+ * Slabs are single arena pages. Size classes holding fewer than two objects
+ * per page are not used; such objects are allocated as whole buddy blocks.
+ *
+ * @param arena the arena to take pages from
+ * @return the slab cache, or NULL if out of memory
+ */
+slab_cache_t *slab_create(buddy_arena_t *arena)
+{
+	slab_cache_t *cache;
+	unsigned int size;
+	int i;
+
+	if(!(cache = malloc(sizeof(*cache))))
+		return NULL;
+
+	cache->arena = arena;
+	cache->page_size = buddy_arena_page_size(arena);
+	pthread_mutex_init(&cache->lock, NULL);
+
+	cache->num_classes = 0;
+	for(i = 0; i < SLAB_NUM_CLASSES && slab_sizes[i] <= cache->page_size; i++){
+		slab_class_t *class = &cache->classes[i];
+
+		INIT_LIST_HEAD(&class->partial);
+		class->obj_size = slab_sizes[i];
+		slab_class_layout(cache, class);
+		if(class->objs_per_slab < SLAB_MIN_OBJS)
+			break;
+		cache->num_classes++;
+	}
+
+	//map every size, in SLAB_ALIGN units, to the smallest class it fits in
+	for(size = 0, i = 0; size <= SLAB_MAX_SIZE / SLAB_ALIGN; size++){
+		while(i < cache->num_classes && cache->classes[i].obj_size < size * SLAB_ALIGN)
+			i++;
+		cache->class_of[size] = i;
+	}
+
+	return cache;
+}
+
+/**
+ * Destroy a slab allocator
+ *
+ * All objects must have been freed already, at which point every slab page is
+ * back in the buddy system.
+ *
+ * @param cache the slab cache. May be NULL
+ */
+void slab_destroy(slab_cache_t *cache)
+{
+	if(!cache)
+		return;
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/**
+ * Allocate an object
+ *
+ * Objects larger than the biggest usable size class are allocated as buddy
+ * blocks of their own. Objects are aligned to 16 bytes.
+ *
+ * @param cache the slab cache
+ * @param size size in bytes
+ * @return address of the object, or NULL if out of memory
+ */
+void *slab_alloc(slab_cache_t *cache, size_t size)
+{
+	if(cache->num_classes == 0 || size > cache->classes[cache->num_classes-1].obj_size)
+		return buddy_arena_alloc(cache->arena, size);
+
+	int class_idx = cache->class_of[(size + SLAB_ALIGN - 1) / SLAB_ALIGN];
+	slab_class_t *class = &cache->classes[class_idx];
+	slab_t *slab;
+	unsigned int w, obj;
+
+	pthread_mutex_lock(&cache->lock);
+
+	if(list_empty(&class->partial))
+		slab = slab_grow(cache, class_idx);
+	else
+		slab = list_entry(class->partial.next, slab_t, list);
+
+	if(!slab){
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	//take the lowest free object
+	for(w = 0; !slab->free_map[w]; w++)
+		;
+	obj = w * 64 + __builtin_ctzll(slab->free_map[w]);
+	slab->free_map[w] &= slab->free_map[w] - 1;
+
+	if(--slab->free_objs == 0)
+		list_del(&slab->list);	//full slabs are on no list
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return (char *)slab + class->objs_offset + (size_t)obj * class->obj_size;
+}
+
+/**
+ * Free an object allocated by slab_alloc
+ *
+ * A slab left with no objects in use is handed back to the buddy system.
+ *
+ * @param cache the slab cache the object was allocated from
+ * @param addr address of the object. NULL is ignored
+ */
+void slab_free(slab_cache_t *cache, void *addr)
+{
+	if(!addr)
+		return;
+
+	slab_t *slab = buddy_arena_page_start(cache->arena, addr);
+
+	//objects never start at a page boundary, because the slab header is there. so this is a whole buddy block
+	if((void *)slab == addr){
+		buddy_arena_free(cache->arena, addr);
+		return;
+	}
+
+	slab_class_t *class = &cache->classes[slab->class_idx];
+	unsigned int obj = ((char *)addr - (char *)slab - class->objs_offset) / class->obj_size;
+
+	pthread_mutex_lock(&cache->lock);
+
+	slab->free_map[obj / 64] |= (uint64_t)1 << (obj % 64);
+
+	if(slab->free_objs++ == 0)
+		list_add(&slab->list, &class->partial);	//it was full, so it is on no list yet
+
+	if(slab->free_objs == class->objs_per_slab){
+		list_del(&slab->list);
+		buddy_arena_free(cache->arena, slab);
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,16 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+/* small objects carved out of buddy pages, grouped in size classes */
+typedef struct slab_cache slab_cache_t;
+
+slab_cache_t *slab_create(buddy_arena_t *arena);
+void slab_destroy(slab_cache_t *cache);
+void *slab_alloc(slab_cache_t *cache, size_t size);
+void slab_free(slab_cache_t *cache, void *addr);
+
+#endif // SLAB_H
@@ -1,8 +1,37 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "buddy.h"
+#include "slab.h"
+#include "numa.h"
+#include "handle.h"
 
 #define TEST1 0
 #define TEST2 1
+#define TEST3 1
+#define TEST4 1
+#define TEST5 1
+#define TEST6 1
+#define TEST7 1
+#define TEST8 1
+#define TEST9 1
+#define TEST10 1
+#define TEST11 1
+#define TEST12 1
+#define TEST13 1
+#define TEST14 1
+#define TEST15 1
+#define TEST16 1
+#define TEST17 1
+#define TEST18 1
+#define TEST19 1
+#define TEST20 1
+#define TEST21 1
+#define TEST22 1
+#define TEST23 1
+#define TEST24 1
+#define TEST25 1
 
 
 unsigned int *b_alloc(unsigned int kbytes){
@@ -96,6 +125,618 @@ void test2(){
 }
 
 
+//arena tests
+void test3(){
+    printf("******************************TEST 3******************************\n");
+
+    //96K is not a whole number of 32K (max order) blocks, so the arena starts with three of them
+    void *mem = malloc(96*1024);
+    buddy_arena_t *arena = buddy_arena_create(mem, 96*1024, 10, 15);
+    buddy_arena_dump(arena);
+
+    void *addr1, *addr2, *addr3;
+    addr1 = buddy_arena_alloc(arena, 100);
+    buddy_arena_dump(arena);
+    addr2 = buddy_arena_alloc(arena, 20*1024);
+    buddy_arena_dump(arena);
+    addr3 = buddy_arena_alloc(arena, 40*1024);
+    printf("40K from a 32K max order arena: %s\n", addr3 ? "allocated" : "NULL");
+
+    buddy_arena_free(arena, addr1);
+    buddy_arena_dump(arena);
+    buddy_arena_free(arena, addr2);
+    buddy_arena_dump(arena);
+
+    buddy_arena_destroy(arena);
+    free(mem);
+}
+
+//bulk tests
+void test4(){
+    printf("******************************TEST 4******************************\n");
+
+    buddy_init();
+    void *addresses[44];
+    int n = buddy_alloc_bulk(8*1024, 40, addresses);
+    printf("bulk allocated %d blocks of 8K\n", n);
+    buddy_dump();
+    n += buddy_alloc_bulk(256*1024, 4, addresses + n);
+    printf("bulk allocated %d blocks of 256K\n", n - 40);
+    buddy_dump();
+    buddy_free_bulk(addresses, n);
+    buddy_dump();
+}
+
+//slab tests
+void test5(){
+    printf("******************************TEST 5******************************\n");
+
+    buddy_init();
+    slab_cache_t *cache = slab_create(buddy_default_arena());
+    void *objects[300];
+
+    //300 objects of 40 bytes fit in 4 pages rather than 300
+    for(int i = 0; i < 300; ++i)
+        objects[i] = slab_alloc(cache, 40);
+    buddy_dump();
+    void *big = slab_alloc(cache, 3000);
+    buddy_dump();
+
+    for(int i = 0; i < 300; ++i)
+        slab_free(cache, objects[i]);
+    buddy_dump();
+    slab_free(cache, big);
+    buddy_dump();
+
+    slab_destroy(cache);
+}
+
+//realloc tests
+void test6(){
+    printf("******************************TEST 6******************************\n");
+
+    buddy_init();
+    unsigned int *addr1, *addr2, *addr3;
+    addr1 = b_alloc(8);
+    addr1[0] = 678;
+
+    //the buddies right above addr1 are free, so it grows in place
+    addr3 = buddy_realloc(addr1, 30*1024);
+    printf("grew %s\n", addr3 == addr1 ? "in place" : "by moving");
+    buddy_dump();
+
+    //addr2 lands right above addr1, so addr1 has to move to grow again
+    addr2 = b_alloc(16);
+    addr3 = buddy_realloc(addr1, 40*1024);
+    printf("grew %s, contents %s\n", addr3 == addr1 ? "in place" : "by moving", addr3[0] == 678 ? "kept" : "LOST");
+    buddy_dump();
+
+    addr1 = buddy_realloc(addr3, 4*1024);
+    printf("shrank %s\n", addr1 == addr3 ? "in place" : "by moving");
+    buddy_dump();
+
+    b_free(addr1);
+    b_free(addr2);
+}
+
+//exact allocation tests
+void test7(){
+    printf("******************************TEST 7******************************\n");
+
+    buddy_init();
+    unsigned int *addr1, *addr2;
+
+    //80K takes 64K + 16K instead of a whole 128K block
+    addr1 = buddy_alloc_exact(80*1024);
+    buddy_dump();
+    addr2 = buddy_alloc_exact(44*1024);
+    buddy_dump();
+    b_free(addr1);
+    b_free(addr2);
+}
+
+//aligned allocation tests
+void test8(){
+    printf("******************************TEST 8******************************\n");
+
+    buddy_init();
+    unsigned int *addr1, *addr2;
+
+    //a 4K block aligned to 256K comes from the start of the 256K free block rather than the 4K one next to addr1
+    addr1 = b_alloc(4);
+    addr2 = buddy_alloc_aligned(4*1024, 256*1024);
+    printf("aligned to 256K: %s\n", ((unsigned long)addr2 % (256*1024)) ? "no" : "yes");
+    buddy_dump();
+    printf("3MB alignment: %s\n", buddy_alloc_aligned(4*1024, 3*1024*1024) ? "allocated" : "NULL");
+    b_free(addr1);
+    b_free(addr2);
+}
+
+//resident memory of this process, in pages
+static long resident_pages(){
+    long size = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm){
+        if(fscanf(statm, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    return resident;
+}
+
+//mmap arena tests
+void test9(){
+    printf("******************************TEST 9******************************\n");
+
+    buddy_arena_t *arena = buddy_arena_create_mmap(64*1024*1024, 12, 24, 0);
+    long before = resident_pages();
+
+    void *addr1 = buddy_arena_alloc(arena, 16*1024*1024);
+    void *addr2 = buddy_arena_alloc(arena, 16*1024*1024);
+    printf("nothing committed until touched: %s\n", resident_pages() - before < 1024 ? "yes" : "no");
+    memset(addr1, 1, 16*1024*1024);
+    memset(addr2, 1, 16*1024*1024);
+    long touched = resident_pages();
+    printf("committed once touched: %s\n", touched - before >= 8192 ? "yes" : "no");
+
+    buddy_arena_free(arena, addr1);
+    buddy_arena_free(arena, addr2);
+    printf("released once coalesced: %s\n", touched - resident_pages() >= 8192 ? "yes" : "no");
+    buddy_arena_dump(arena);
+
+    buddy_arena_destroy(arena);
+}
+
+//huge page arena tests
+void test10(){
+    printf("******************************TEST 10******************************\n");
+
+    //max order 20 is raised to the 2MB huge page order
+    buddy_arena_t *arena = buddy_arena_create_mmap(8*1024*1024, 12, 20, BUDDY_ARENA_HUGEPAGE);
+    printf("intact huge pages: %ld\n", buddy_arena_intact_blocks(arena, BUDDY_HUGE_PAGE_ORDER));
+
+    void *addr1 = buddy_arena_alloc(arena, 4*1024);
+    printf("intact huge pages: %ld\n", buddy_arena_intact_blocks(arena, BUDDY_HUGE_PAGE_ORDER));
+    //served from the huge page addr1 already broke up
+    void *addr2 = buddy_arena_alloc(arena, 512*1024);
+    void *addr3 = buddy_arena_alloc(arena, 2*1024*1024);
+    printf("intact huge pages: %ld, 2MB aligned: %s\n", buddy_arena_intact_blocks(arena, BUDDY_HUGE_PAGE_ORDER),
+           ((unsigned long)addr3 % (2*1024*1024)) ? "no" : "yes");
+
+    buddy_arena_free(arena, addr1);
+    buddy_arena_free(arena, addr2);
+    buddy_arena_free(arena, addr3);
+    printf("intact huge pages: %ld\n", buddy_arena_intact_blocks(arena, BUDDY_HUGE_PAGE_ORDER));
+
+    buddy_arena_destroy(arena);
+}
+
+//NUMA zone tests, on fake nodes
+void test11(){
+    printf("******************************TEST 11******************************\n");
+
+    static char memory[4*1024*1024] __attribute__((aligned(1024*1024)));
+    numa_zones_t *zones = numa_zones_create_fake(memory, sizeof(memory), 4, 12, 20, 0);
+    void *addrs[4];
+    int i;
+
+    //a node serves itself while it can
+    void *local = numa_alloc_node(zones, 64*1024, 1);
+    printf("node 1 allocation from node %d\n", numa_node_of(zones, local));
+
+    //then falls back to the closest node with room: node 1 is partly used, so 3, then 0
+    for(i = 0; i < 4; i++){
+        addrs[i] = numa_alloc_node(zones, 1024*1024, 2);
+        printf("node 2 allocation %d from node %d\n", i, numa_node_of(zones, addrs[i]));
+    }
+
+    numa_free(zones, local);
+    for(i = 0; i < 4; i++)
+        numa_free(zones, addrs[i]);
+    for(i = 0; i < 4; i++)
+        buddy_arena_dump(numa_zone_arena(zones, i));
+
+    numa_zones_destroy(zones);
+}
+
+//placement policy tests
+/*
+ * 8K blocks are free at 8K (buddy allocated whole), then at 24K (buddy split
+ * into a 4K block and a free 4K page) and at 40K (buddy allocated whole), in
+ * that order
+ */
+static void placement_scenario(buddy_placement_t placement, const char *name){
+    static char memory[64*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 16);
+    void *blocks[8];
+    int i;
+
+    buddy_arena_set_placement(arena, placement);
+    for(i = 0; i < 8; i++)
+        blocks[i] = buddy_arena_alloc(arena, 8*1024);
+    buddy_arena_free(arena, blocks[1]);
+    buddy_arena_realloc(arena, blocks[2], 4*1024);
+    buddy_arena_free(arena, blocks[3]);
+    buddy_arena_free(arena, blocks[5]);
+    if(placement == BUDDY_PLACEMENT_FIFO)
+        printf("fragmentation: %.3f\n", buddy_arena_fragmentation(arena));
+
+    void *addr = buddy_arena_alloc(arena, 8*1024);
+    printf("%s: 8K block at %ldK\n", name, (long)((char *)addr - memory) / 1024);
+
+    buddy_arena_destroy(arena);
+}
+
+void test12(){
+    printf("******************************TEST 12******************************\n");
+
+    placement_scenario(BUDDY_PLACEMENT_FIFO, "fifo");
+    placement_scenario(BUDDY_PLACEMENT_LIFO, "lifo");
+    placement_scenario(BUDDY_PLACEMENT_ADDRESS, "address");
+    placement_scenario(BUDDY_PLACEMENT_BUDDY_BUSY, "buddy");
+}
+
+//handle and compaction tests
+void test13(){
+    printf("******************************TEST 13******************************\n");
+
+    static char memory[64*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 16);
+    handle_table_t *table = handle_table_create(arena);
+    buddy_handle_t handles[16];
+    int i, intact = 1;
+
+    for(i = 0; i < 16; i++){
+        handles[i] = handle_alloc(table, 4*1024);
+        *(int *)handle_addr(table, handles[i]) = i;
+    }
+    //every other page free: half the arena, but not a single 8K block
+    for(i = 1; i < 16; i += 2)
+        handle_free(table, handles[i]);
+    buddy_arena_dump(arena);
+    printf("fragmentation: %.3f\n", buddy_arena_fragmentation(arena));
+
+    //pinned blocks stay put
+    void *pinned = handle_pin(table, handles[14]);
+    printf("moved: %zu, pinned block stayed: %s\n", handle_compact(table), handle_addr(table, handles[14]) == pinned ? "yes" : "no");
+    buddy_arena_dump(arena);
+    handle_unpin(table, handles[14]);
+
+    //an allocation that would fail compacts the arena by itself, even without a handle
+    void *big = buddy_arena_alloc(arena, 32*1024);
+    printf("32K block: %s\n", big ? "served" : "failed");
+    buddy_arena_dump(arena);
+
+    for(i = 0; i < 16; i += 2)
+        intact &= *(int *)handle_addr(table, handles[i]) == i;
+    printf("contents intact: %s\n", intact ? "yes" : "no");
+
+    buddy_arena_free(arena, big);
+    handle_table_destroy(table);
+    buddy_arena_dump(arena);
+    buddy_arena_destroy(arena);
+}
+
+//lazy coalescing tests
+void test14(){
+    printf("******************************TEST 14******************************\n");
+
+    static char memory[1024*1024] __attribute__((aligned(1024*1024)));
+    buddy_arena_t *arena = buddy_arena_create_flags(memory, sizeof(memory), 12, 20, BUDDY_ARENA_LAZY);
+    void *addrs[100];
+    int i;
+
+    //a freed block is parked, not merged, and comes straight back
+    void *addr1 = buddy_arena_alloc(arena, 4*1024);
+    buddy_arena_free(arena, addr1);
+    buddy_arena_dump(arena);
+    void *addr2 = buddy_arena_alloc(arena, 4*1024);
+    printf("same block back: %s\n", addr1 == addr2 ? "yes" : "no");
+    buddy_arena_free(arena, addr2);
+
+    //past the watermark, the oldest parked blocks coalesce
+    for(i = 0; i < 100; i++)
+        addrs[i] = buddy_arena_alloc(arena, 4*1024);
+    for(i = 0; i < 100; i++)
+        buddy_arena_free(arena, addrs[i]);
+    buddy_arena_dump(arena);
+
+    //memory pressure coalesces the rest
+    void *addr3 = buddy_arena_alloc(arena, 1024*1024);
+    printf("1MB block under pressure: %s\n", addr3 ? "served" : "failed");
+    buddy_arena_free(arena, addr3);
+    buddy_arena_drain(arena);
+    buddy_arena_dump(arena);
+
+    buddy_arena_destroy(arena);
+}
+
+//statistics tests
+void test15(){
+    printf("******************************TEST 15******************************\n");
+
+    static char memory[1024*1024] __attribute__((aligned(1024*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 20);
+    buddy_stats_t stats;
+    int o;
+
+    void *addr1 = buddy_arena_alloc(arena, 5*1024);
+    void *addr2 = buddy_arena_alloc(arena, 100);
+    void *addr3 = buddy_arena_alloc(arena, 2*1024*1024);
+    buddy_arena_free(arena, addr1);
+    buddy_arena_stats(arena, &stats);
+    printf("requested %zu, granted %zu, in use %zu, peak %zu, failed %lu, largest free order %d\n",
+           stats.bytes_requested, stats.bytes_granted, stats.in_use, stats.peak_in_use, stats.failed, stats.largest_free_order);
+
+    buddy_arena_free(arena, addr2);
+    buddy_arena_free(arena, addr3);
+    buddy_arena_stats(arena, &stats);
+    for(o = stats.min_order; o <= stats.max_order; o++)
+        printf("order %d: %lu allocs, %lu frees, %lu splits, %lu merges\n", o, stats.allocs[o], stats.frees[o], stats.splits[o], stats.merges[o]);
+    printf("in use %zu, largest free order %d\n", stats.in_use, stats.largest_free_order);
+
+    buddy_arena_destroy(arena);
+}
+
+//structured dump tests
+void test16(){
+    printf("******************************TEST 16******************************\n");
+
+    static char memory[64*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 16);
+
+    buddy_arena_dump_json(arena);
+    void *addr1 = buddy_arena_alloc(arena, 4*1024);
+    void *addr2 = buddy_arena_alloc(arena, 16*1024);
+    buddy_arena_dump(arena);
+    buddy_arena_dump_json(arena);
+    buddy_arena_free(arena, addr1);
+    buddy_arena_free(arena, addr2);
+    buddy_arena_dump_json(arena);
+
+    buddy_arena_destroy(arena);
+}
+
+
+//one thread of the concurrent arena tests: allocates blocks of mixed orders, tags them, checks the tags survived everyone else's allocations, frees them
+#define MT_THREADS 8
+#define MT_BLOCKS 32
+#define MT_ROUNDS 50
+
+typedef struct {
+    buddy_arena_t *arena;
+    pthread_barrier_t *barrier;
+    int id;
+    int min_kbytes, orders;   //blocks of min_kbytes << 0 .. orders-1
+    int corrupted;
+    void *addrs[MT_BLOCKS];
+    size_t sizes[MT_BLOCKS];
+} mt_thread_t;
+
+void *mt_thread(void *arg){
+    mt_thread_t *t = arg;
+    int round, i;
+
+    for(round = 0; round < MT_ROUNDS; round++){
+        for(i = 0; i < MT_BLOCKS; i++){
+            t->sizes[i] = (size_t)t->min_kbytes * 1024 << ((i + round + t->id) % t->orders);
+            if((t->addrs[i] = buddy_arena_alloc(t->arena, t->sizes[i])))
+                memset(t->addrs[i], t->id + 1, t->sizes[i]);
+        }
+        pthread_barrier_wait(t->barrier);   //every thread holds its blocks now
+        for(i = 0; i < MT_BLOCKS; i++){
+            unsigned char *bytes = t->addrs[i];
+            size_t j;
+            for(j = 0; bytes && j < t->sizes[i]; j += 512)
+                if(bytes[j] != t->id + 1)
+                    t->corrupted++;
+        }
+        pthread_barrier_wait(t->barrier);
+        for(i = 0; i < MT_BLOCKS; i++)
+            buddy_arena_free(t->arena, t->addrs[i]);
+    }
+    return NULL;
+}
+
+//runs mt_thread on MT_THREADS threads sharing a concurrent arena, and reports whether their blocks stayed disjoint and were all given back
+void mt_run(int min_kbytes, int orders){
+    static char memory[16*1024*1024] __attribute__((aligned(16*1024*1024)));
+    buddy_arena_t *arena = buddy_arena_create_flags(memory, sizeof(memory), 12, 24, BUDDY_ARENA_CONCURRENT);
+    mt_thread_t threads[MT_THREADS];
+    pthread_t tids[MT_THREADS];
+    pthread_barrier_t barrier;
+    buddy_stats_t stats;
+    int corrupted = 0, i;
+
+    pthread_barrier_init(&barrier, NULL, MT_THREADS);
+    for(i = 0; i < MT_THREADS; i++){
+        threads[i] = (mt_thread_t){ .arena = arena, .barrier = &barrier, .id = i, .min_kbytes = min_kbytes, .orders = orders };
+        pthread_create(&tids[i], NULL, mt_thread, &threads[i]);
+    }
+    for(i = 0; i < MT_THREADS; i++){
+        pthread_join(tids[i], NULL);
+        corrupted += threads[i].corrupted;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    buddy_arena_stats(arena, &stats);
+    printf("blocks disjoint: %s, failed: %lu, in use after free: %zu\n", corrupted ? "no" : "yes", stats.failed, stats.in_use);
+    buddy_arena_drain(arena);
+    buddy_arena_dump(arena);
+    buddy_arena_destroy(arena);
+}
+
+//concurrent arena tests: pages from the lock-free stack, small blocks from the per-CPU caches, larger ones from the free area
+void test17(){
+    printf("******************************TEST 17******************************\n");
+
+    mt_run(4, 6);
+}
+
+//concurrent arena test with single pages only, which all go through the per-CPU lock-free stacks
+void test18(){
+    printf("******************************TEST 18******************************\n");
+
+    mt_run(4, 1);
+}
+
+
+//reclaim callback of the reclaim tests: frees the block it was handed through ctx
+int bulk_reclaim(buddy_arena_t *arena, size_t size, void *ctx){
+    void **held = ctx;
+
+    (void)size;
+    if(!*held)
+        return 0;
+    buddy_arena_free(arena, *held);
+    *held = NULL;
+    printf("reclaim called\n");
+    return 1;
+}
+
+//fills an arena of 256 pages with single pages, keeps one back for the reclaim callback and frees the rest into the arena's caches, then bulk allocates all 256
+void bulk_shortfall(unsigned flags){
+    static char memory[1024*1024] __attribute__((aligned(1024*1024)));
+    buddy_arena_t *arena = buddy_arena_create_flags(memory, sizeof(memory), 12, 20, flags);
+    static void *addrs[256];
+    void *held;
+    int i, n;
+
+    for(i = 0; i < 256; i++)
+        addrs[i] = buddy_arena_alloc(arena, 4*1024);
+    held = addrs[0];
+    for(i = 1; i < 256; i++)
+        buddy_arena_free(arena, addrs[i]);
+    buddy_arena_set_reclaim(arena, bulk_reclaim, &held);
+
+    n = buddy_arena_alloc_bulk(arena, 4*1024, 256, addrs);
+    printf("bulk allocated %d of 256\n", n);
+    buddy_arena_free_bulk(arena, addrs, n);
+    buddy_arena_drain(arena);
+    buddy_arena_dump(arena);
+    buddy_arena_destroy(arena);
+}
+
+//bulk allocation out of a concurrent arena whose free pages all sit in its caches or with the reclaim callback
+void test19(){
+    printf("******************************TEST 19******************************\n");
+
+    bulk_shortfall(BUDDY_ARENA_CONCURRENT);
+}
+
+//bulk allocation out of a lazy arena whose free pages are all parked uncoalesced
+void test20(){
+    printf("******************************TEST 20******************************\n");
+
+    bulk_shortfall(BUDDY_ARENA_LAZY);
+}
+
+
+//aligned allocation from an arena whose base is only page aligned: alignments past the base's fail, whether or not they exceed the block size
+void test21(){
+    printf("******************************TEST 21******************************\n");
+
+    static char memory[512*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory + 4*1024, 256*1024, 12, 16);
+    char *addr;
+
+    addr = buddy_arena_alloc_aligned(arena, 4*1024, 4*1024);
+    printf("4K aligned to 4K: %s\n", !addr ? "NULL" : ((unsigned long)addr % (4*1024)) ? "misaligned" : "aligned");
+    buddy_arena_free(arena, addr);
+    addr = buddy_arena_alloc_aligned(arena, 64*1024, 64*1024);
+    printf("64K aligned to 64K: %s\n", !addr ? "NULL" : ((unsigned long)addr % (64*1024)) ? "misaligned" : "aligned");
+    addr = buddy_arena_alloc_aligned(arena, 4*1024, 64*1024);
+    printf("4K aligned to 64K: %s\n", !addr ? "NULL" : ((unsigned long)addr % (64*1024)) ? "misaligned" : "aligned");
+    buddy_arena_dump(arena);
+    buddy_arena_destroy(arena);
+}
+
+
+//mapped arenas release free memory in 2MB granules, even while other blocks keep it from coalescing to max_order
+void test22(){
+    printf("******************************TEST 22******************************\n");
+
+    buddy_arena_t *arena = buddy_arena_create_mmap(64*1024*1024, 12, 24, 0);
+    void *small = buddy_arena_alloc(arena, 4*1024);
+    void *addr = buddy_arena_alloc(arena, 2*1024*1024);
+
+    memset(small, 1, 4*1024);
+    memset(addr, 1, 2*1024*1024);
+    long touched = resident_pages();
+    buddy_arena_free(arena, addr);
+    printf("released without coalescing to max order: %s\n", touched - resident_pages() >= 512 ? "yes" : "no");
+
+    buddy_arena_free(arena, small);
+    buddy_arena_destroy(arena);
+}
+
+
+//exact allocation from a full arena, served once the reclaim callback frees a block
+void test23(){
+    printf("******************************TEST 23******************************\n");
+
+    static char memory[64*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 16);
+    void *held = buddy_arena_alloc(arena, 16*1024);
+    void *rest[2] = { buddy_arena_alloc(arena, 16*1024), buddy_arena_alloc(arena, 32*1024) };
+
+    buddy_arena_set_reclaim(arena, bulk_reclaim, &held);
+    void *addr = buddy_arena_alloc_exact(arena, 12*1024);
+    printf("12K exact allocation: %s\n", addr ? "allocated" : "NULL");
+    buddy_arena_dump(arena);
+
+    buddy_arena_free(arena, addr);
+    buddy_arena_free(arena, rest[0]);
+    buddy_arena_free(arena, rest[1]);
+    buddy_arena_destroy(arena);
+}
+
+
+//shrinking a large block in place gives the freed halves of the release order or above back to the kernel
+void test24(){
+    printf("******************************TEST 24******************************\n");
+
+    buddy_arena_t *arena = buddy_arena_create_mmap(64*1024*1024, 12, 24, 0);
+    void *addr = buddy_arena_alloc(arena, 4*1024*1024);
+
+    memset(addr, 1, 4*1024*1024);
+    long touched = resident_pages();
+    void *shrunk = buddy_arena_realloc(arena, addr, 4*1024);
+    printf("shrunk in place: %s\n", shrunk == addr ? "yes" : "no");
+    printf("released the freed 2MB half: %s\n", touched - resident_pages() >= 512 ? "yes" : "no");
+
+    buddy_arena_free(arena, shrunk);
+    buddy_arena_destroy(arena);
+}
+
+
+//a handle table keeps the reclaim callback registered before it: chained to while the table lives, put back when it is destroyed
+void test25(){
+    printf("******************************TEST 25******************************\n");
+
+    static char memory[64*1024] __attribute__((aligned(64*1024)));
+    buddy_arena_t *arena = buddy_arena_create(memory, sizeof(memory), 12, 16);
+    void *held = buddy_arena_alloc(arena, 16*1024);
+    void *rest[2] = { buddy_arena_alloc(arena, 16*1024), buddy_arena_alloc(arena, 32*1024) };
+    void *addr;
+
+    buddy_arena_set_reclaim(arena, bulk_reclaim, &held);
+    handle_table_t *table = handle_table_create(arena);
+    addr = buddy_arena_alloc(arena, 16*1024);
+    printf("with the table: %s\n", addr ? "allocated" : "NULL");
+
+    held = addr;
+    handle_table_destroy(table);
+    addr = buddy_arena_alloc(arena, 16*1024);
+    printf("after destroying it: %s\n", addr ? "allocated" : "NULL");
+
+    buddy_arena_free(arena, addr);
+    buddy_arena_free(arena, rest[0]);
+    buddy_arena_free(arena, rest[1]);
+    buddy_arena_destroy(arena);
+}
+
+
 int main(){
     
     #if TEST1
@@ -104,5 +745,74 @@ int main(){
     #if TEST2
         test2();
     #endif
+    #if TEST3
+        test3();
+    #endif
+    #if TEST4
+        test4();
+    #endif
+    #if TEST5
+        test5();
+    #endif
+    #if TEST6
+        test6();
+    #endif
+    #if TEST7
+        test7();
+    #endif
+    #if TEST8
+        test8();
+    #endif
+    #if TEST9
+        test9();
+    #endif
+    #if TEST10
+        test10();
+    #endif
+    #if TEST11
+        test11();
+    #endif
+    #if TEST12
+        test12();
+    #endif
+    #if TEST13
+        test13();
+    #endif
+    #if TEST14
+        test14();
+    #endif
+    #if TEST15
+        test15();
+    #endif
+    #if TEST16
+        test16();
+    #endif
+    #if TEST17
+        test17();
+    #endif
+    #if TEST18
+        test18();
+    #endif
+    #if TEST19
+        test19();
+    #endif
+    #if TEST20
+        test20();
+    #endif
+    #if TEST21
+        test21();
+    #endif
+    #if TEST22
+        test22();
+    #endif
+    #if TEST23
+        test23();
+    #endif
+    #if TEST24
+        test24();
+    #endif
+    #if TEST25
+        test25();
+    #endif
 
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* first bytes of a binary trace, followed by its records up to the end of the file */
+#define TRACE_MAGIC "BUDDYTR1"
+#define TRACE_MAGIC_LEN 8
+
+/* operations of a binary trace record */
+#define TRACE_OP_ALLOC 1
+#define TRACE_OP_FREE 2
+
+/* one operation of a binary trace, in host byte order. 16 bytes, so records stay aligned when the trace is mapped */
+typedef struct trace_record_t {
+	uint8_t op;		/* TRACE_OP_ALLOC or TRACE_OP_FREE */
+	uint8_t reserved[3];	/* 0 */
+	uint32_t var;		/* variable id. Ids are dense indices, so keep them small */
+	uint64_t size;		/* bytes to allocate, 0 for frees */
+} trace_record_t;
+
+#endif // TRACE_H
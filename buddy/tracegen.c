@@ -0,0 +1,374 @@
+/**
+ * Synthetic Trace Generator
+ *
+ * Writes allocation traces for the simulator, as text (`x=alloc(NK)`) or in
+ * the binary format of trace.h. Block sizes follow a uniform, power-law or
+ * bimodal distribution, and the trace may be cut into phases that cycle
+ * through several of them. Every block gets a lifetime from an exponential,
+ * uniform or fixed distribution and is freed once it has lived that many
+ * operations, or earlier if the working set is full. The same seed always
+ * gives the same trace.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/**************************************************************************
+ * Public Definitions
+ **************************************************************************/
+/* most size distributions -d may list, one per phase */
+#define GEN_MAX_DISTS 8
+
+/* fraction of bimodal sizes drawn from the small mode */
+#define GEN_BIMODAL_SMALL 0.9
+
+/**************************************************************************
+ * Public Types
+ **************************************************************************/
+/**
+ * Block size distributions
+ */
+typedef enum {
+	SIZE_UNIFORM,	///< Uniform between the smallest and largest size
+	SIZE_POWER,	///< Power law (Pareto) from the smallest size, capped at the largest
+	SIZE_BIMODAL	///< Mostly small sizes near the smallest, the rest near the largest
+} size_dist_t;
+
+/**
+ * Lifetime distributions
+ */
+typedef enum {
+	LIFE_EXP,	///< Exponential: many short-lived blocks, a few long-lived ones
+	LIFE_UNIFORM,	///< Uniform between 1 and twice the mean
+	LIFE_FIXED	///< Every block lives exactly the mean
+} life_dist_t;
+
+/**
+ * A live block, kept in a min-heap by the operation it dies at
+ */
+typedef struct {
+	uint64_t death;	///< Operation after which the block is freed
+	uint32_t var;	///< Variable id holding the block
+} gen_block_t;
+
+/**
+ * Generator state
+ */
+typedef struct {
+	uint64_t rng;			///< State of the random number generator
+	gen_block_t *heap;		///< Live blocks, soonest death first
+	size_t live;			///< Number of live blocks
+	uint32_t *unused;		///< Stack of variable ids free for reuse
+	size_t num_unused;		///< Number of ids on the stack
+	uint32_t next_var;		///< Lowest id never handed out
+	FILE *out;			///< Where the trace goes
+	bool binary;			///< Write the binary format rather than text
+} gen_t;
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+//next number of a splitmix64 generator
+static uint64_t gen_rand(gen_t *gen){
+	uint64_t z = (gen->rng += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//uniform random number in (0, 1]
+static double gen_unit(gen_t *gen){
+	return ((gen_rand(gen) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+//draws a block size
+/*
+ * @param gen the generator
+ * @param dist the size distribution
+ * @param min smallest size
+ * @param max largest size
+ * @param alpha shape of the power law, larger means fewer large blocks
+ * @return the size in bytes
+ */
+static uint64_t gen_size(gen_t *gen, size_dist_t dist, uint64_t min, uint64_t max, double alpha){
+	double size;
+
+	switch (dist) {
+	case SIZE_POWER:
+		size = min * pow(gen_unit(gen), -1.0 / alpha);
+		break;
+	case SIZE_BIMODAL:
+		if (gen_unit(gen) <= GEN_BIMODAL_SMALL)
+			size = min + (min * 3) * gen_unit(gen);		//between min and 4 * min
+		else
+			size = max - (max * 0.75) * gen_unit(gen);	//between max / 4 and max
+		break;
+	default:
+		size = min + (max - min) * gen_unit(gen);
+	}
+
+	if (size < min)
+		return min;
+	return size > max ? max : (uint64_t)size;
+}
+
+//draws a lifetime, in operations
+static uint64_t gen_lifetime(gen_t *gen, life_dist_t dist, double mean){
+	double life;
+
+	switch (dist) {
+	case LIFE_UNIFORM:
+		life = 2 * mean * gen_unit(gen);
+		break;
+	case LIFE_FIXED:
+		life = mean;
+		break;
+	default:
+		life = -mean * log(gen_unit(gen));
+	}
+	return life < 1 ? 1 : (uint64_t)life;
+}
+
+//restores the heap order from the given entry up
+static void heap_up(gen_t *gen, size_t i){
+	gen_block_t block = gen->heap[i];
+
+	while (i > 0 && gen->heap[(i - 1) / 2].death > block.death) {
+		gen->heap[i] = gen->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	gen->heap[i] = block;
+}
+
+//restores the heap order from the root down
+static void heap_down(gen_t *gen){
+	gen_block_t block = gen->heap[0];
+	size_t i = 0, child;
+
+	while ((child = 2 * i + 1) < gen->live) {
+		if (child + 1 < gen->live && gen->heap[child + 1].death < gen->heap[child].death)
+			child++;
+		if (gen->heap[child].death >= block.death)
+			break;
+		gen->heap[i] = gen->heap[child];
+		i = child;
+	}
+	gen->heap[i] = block;
+}
+
+//writes one operation of the trace
+/*
+ * @param gen the generator
+ * @param op TRACE_OP_ALLOC or TRACE_OP_FREE
+ * @param var variable id
+ * @param size bytes to allocate, 0 for frees
+ */
+static void gen_emit(gen_t *gen, int op, uint32_t var, uint64_t size){
+	if (gen->binary) {
+		trace_record_t record = { .op = op, .var = var, .size = size };
+
+		fwrite(&record, sizeof(record), 1, gen->out);
+	}
+	else if (op == TRACE_OP_FREE)
+		fprintf(gen->out, "free(v%u)\n", var);
+	else if (size % 1024 == 0)
+		fprintf(gen->out, "v%u=alloc(%lluK)\n", var, (unsigned long long)size / 1024);
+	else
+		fprintf(gen->out, "v%u=alloc(%llu)\n", var, (unsigned long long)size);
+}
+
+//frees the block dying soonest
+static void gen_free(gen_t *gen){
+	uint32_t var = gen->heap[0].var;
+
+	gen_emit(gen, TRACE_OP_FREE, var, 0);
+	gen->unused[gen->num_unused++] = var;
+	gen->heap[0] = gen->heap[--gen->live];
+	if (gen->live)
+		heap_down(gen);
+}
+
+//allocates a block that dies at the given operation
+static void gen_alloc(gen_t *gen, uint64_t size, uint64_t death){
+	uint32_t var = gen->num_unused ? gen->unused[--gen->num_unused] : gen->next_var++;
+
+	gen_emit(gen, TRACE_OP_ALLOC, var, size);
+	gen->heap[gen->live].death = death;
+	gen->heap[gen->live].var = var;
+	heap_up(gen, gen->live++);
+}
+
+//looks a distribution up by name
+/*
+ * @param name the name
+ * @param names the names of the distributions, in enum order
+ * @param count number of names
+ * @return the distribution, or -1 if there is none by that name
+ */
+static int dist_by_name(const char *name, const char *const *names, int count){
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-n ops] [-s seed] [-o file] [-b] [-d dists] [-m min] [-M max] [-a alpha]\n", prog_name);
+	fprintf(out, "     [-l lifetime] [-L mean] [-w blocks] [-p phases] [-e]\n");
+	fprintf(out, "     -n - Number of operations (default 100000).\n");
+	fprintf(out, "     -s - Seed; the same seed gives the same trace (default 1).\n");
+	fprintf(out, "     -o - Output file (default standard output).\n");
+	fprintf(out, "     -b - Write the binary format of trace.h instead of text.\n");
+	fprintf(out, "     -d - Size distribution: uniform, power or bimodal (default power). A comma\n");
+	fprintf(out, "          separated list is cycled through phase by phase.\n");
+	fprintf(out, "     -m - Smallest block size in bytes (default 16).\n");
+	fprintf(out, "     -M - Largest block size in bytes (default 65536).\n");
+	fprintf(out, "     -a - Power law exponent; larger means fewer large blocks (default 1.2).\n");
+	fprintf(out, "     -l - Lifetime distribution: exp, uniform or fixed (default exp).\n");
+	fprintf(out, "     -L - Mean lifetime in operations (default 1000).\n");
+	fprintf(out, "     -w - Most live blocks at once; the block dying soonest is freed early\n");
+	fprintf(out, "          to make room (default 10000).\n");
+	fprintf(out, "     -p - Number of phases the operations are split into (default one per\n");
+	fprintf(out, "          size distribution).\n");
+	fprintf(out, "     -e - Free every live block at the end, so the trace leaves memory empty.\n");
+}
+
+int main(int argc, char** argv)
+{
+	static const char *const size_names[] = { "uniform", "power", "bimodal" };
+	static const char *const life_names[] = { "exp", "uniform", "fixed" };
+	size_dist_t dists[GEN_MAX_DISTS] = { SIZE_POWER };
+	int num_dists = 1, phases = 0;
+	life_dist_t life = LIFE_EXP;
+	uint64_t ops = 100000, min = 16, max = 65536, seed = 1, op;
+	double alpha = 1.2, mean_life = 1000;
+	size_t max_live = 10000;
+	bool drain = false;
+	const char *path = NULL;
+	char *name;
+	gen_t gen = { 0 };
+	int opt, d;
+
+	while ((opt = getopt(argc, argv, "n:s:o:bd:m:M:a:l:L:w:p:eh")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		case 'b':
+			gen.binary = true;
+			break;
+		case 'd':
+			for (num_dists = 0, name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+				if (num_dists == GEN_MAX_DISTS || (d = dist_by_name(name, size_names, 3)) < 0) {
+					fprintf(stderr, "ERROR: Bad size distribution '%s'\n", name);
+					return EXIT_FAILURE;
+				}
+				dists[num_dists++] = d;
+			}
+			break;
+		case 'm':
+			min = strtoull(optarg, NULL, 10);
+			break;
+		case 'M':
+			max = strtoull(optarg, NULL, 10);
+			break;
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 'l':
+			if ((d = dist_by_name(optarg, life_names, 3)) < 0) {
+				fprintf(stderr, "ERROR: Bad lifetime distribution '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			life = d;
+			break;
+		case 'L':
+			mean_life = atof(optarg);
+			break;
+		case 'w':
+			max_live = strtoull(optarg, NULL, 10);
+			break;
+		case 'p':
+			phases = atoi(optarg);
+			break;
+		case 'e':
+			drain = true;
+			break;
+		case 'h':
+			print_usage(argv[0], stdout);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (num_dists < 1 || min < 1 || max < min || alpha <= 0 || mean_life <= 0 || max_live < 1 || phases < 0 ||
+	    (!gen.binary && max > INT32_MAX)) {
+		print_usage(argv[0], stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (phases == 0)
+		phases = num_dists;
+
+	if (!(gen.out = path ? fopen(path, gen.binary ? "wb" : "w") : stdout)) {
+		perror("ERROR: Failed to open output file");
+		return EXIT_FAILURE;
+	}
+	gen.rng = seed;
+	gen.heap = malloc(max_live * sizeof(*gen.heap));
+	gen.unused = malloc(max_live * sizeof(*gen.unused));
+	if (!gen.heap || !gen.unused) {
+		perror("ERROR: Out of memory");
+		return EXIT_FAILURE;
+	}
+
+	if (gen.binary)
+		fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, gen.out);
+
+	for (op = 0; op < ops; op++) {
+		size_dist_t dist = dists[(op * phases / ops) % num_dists];
+
+		//blocks die when their time is up, or make room when the working set is full
+		if (gen.live && (gen.heap[0].death <= op || gen.live == max_live))
+			gen_free(&gen);
+		else
+			gen_alloc(&gen, gen_size(&gen, dist, min, max, alpha), op + gen_lifetime(&gen, life, mean_life));
+	}
+	while (drain && gen.live)
+		gen_free(&gen);
+
+	free(gen.heap);
+	free(gen.unused);
+	if (gen.out != stdout)
+		fclose(gen.out);
+	return EXIT_SUCCESS;
+}